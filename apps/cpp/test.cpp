@@ -139,6 +139,8 @@ int main(int argc, char** argv) {
 			if (pout.extension().string() == ".hdf5") {
 				interp_filtered->writeHDFfile(fout.c_str(),
 					SDBR_write_type::SDBR_TRUNCATE);
+			} else if (pout.extension().string() == ".sdbbin") {
+				interp_filtered->writeBinaryFile(fout.c_str());
 			} else {
 				interp_filtered->writeTextFile(fout.c_str());
 			}
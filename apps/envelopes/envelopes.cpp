@@ -88,6 +88,9 @@ int main(int argc, char** argv) {
 		makeHeader();
 		cout << "Header written" << std::endl;
 
+		// Build every filter combination, then select all of them in one pass
+		vector<std::shared_ptr<const filter> > filters;
+		vector<string> labels;
 		for (const auto &sFT : vFlakeTypes)
 		for (const auto &sFr : vFreqs)
 		for (const auto &sT  : vTemps)
@@ -96,18 +99,23 @@ int main(int argc, char** argv) {
 		{
 			auto f = filter::generate();
 
-			cout << sFT << "\t" << sFr << "\t" << sT << "\t" << sAe << "\t" << sMD << std::endl;
 			//f->addFilterInt(db::data_entries::SDBR_FLAKETYPE, sFT);
 			f->addFilterFloat(db::data_entries::SDBR_FREQUENCY_GHZ, sFr);
 			f->addFilterFloat(db::data_entries::SDBR_TEMPERATURE_K, sT);
 			f->addFilterFloat(db::data_entries::SDBR_AEFF_UM, sAe);
 			f->addFilterFloat(db::data_entries::SDBR_MAX_DIMENSION_MM, sMD);
+			filters.push_back(f);
+			labels.push_back(sFT + "\t" + sFr + "\t" + sT + "\t" + sAe + "\t" + sMD);
+		}
+		auto views = filter::applyMany(filters, sdb);
 
-			auto sdb_filtered = f->apply(sdb);
-			auto stats = sdb_filtered->getStats();
-			if (stats->count == 0) continue;
+		for (size_t k = 0; k < views.size(); ++k)
+		{
+			cout << labels[k] << std::endl;
+			if (!views[k]->numRows()) continue;
+			auto stats = views[k]->getStats();
 
-			out << sFT << "\t" << sFr << "\t" << sT << "\t" << sAe << "\t" << sMD << "\t";
+			out << labels[k] << "\t";
 
 
 //				out << "\tMIN\tMAX\tMEDIAN\tMEAN\tSD\tSKEWNESS\tKURTOSIS\n";
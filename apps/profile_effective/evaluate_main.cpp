@@ -377,14 +377,14 @@ int main(int argc, char** argv) {
 			auto f = filter::generate();
 			f->addFilterInt(db::data_entries::SDBR_FLAKETYPE, filter.sCats);
 			f->addFilterFloat(db::data_entries::SDBR_TEMPERATURE_K, filter.sTemps);
-			auto db_ros = f->apply(sdb);
+			auto db_ros = f->applyView(sdb);
 
 			// Profile information
 			std::cerr << "Working on case " << filtname << " with name " << filter.sName
 				<< " and cats " << filter.sCats << " and temps " << filter.sTemps
-				<< ", with " << db_ros->intMat.rows() << " rows. Sdb has " << sdb->intMat.rows() << " rows." << std::endl;
+				<< ", with " << db_ros->numRows() << " rows. Sdb has " << sdb->intMat.rows() << " rows." << std::endl;
 			auto fsros = scatdb::plugins::hdf5::openOrCreateGroup(filtbase, "scatdb_filtered");
-			if (db_ros->intMat.rows() == 0) {
+			if (db_ros->numRows() == 0) {
 				std::cerr << filtname << " with filter cats " << filter.sCats << " and temps " << filter.sTemps
 					<< " has no data." << std::endl;
 				filtnum++;
@@ -397,8 +397,8 @@ int main(int argc, char** argv) {
 			for (const auto &freq : freqranges) {
 				auto ff = filter::generate();
 				ff->addFilterFloat(db::data_entries::SDBR_FREQUENCY_GHZ, freq.sRange);
-				auto db_ros_f = ff->apply(db_ros);
-				if (db_ros_f->floatMat.rows() == 0) {
+				auto db_ros_f = ff->applyView(db_ros);
+				if (db_ros_f->numRows() == 0) {
 					std::cerr << "Error: At frequency band " << freq.sBandName << " / range " << freq.sRange << ", there were "
 						<< "no data points available in the selected dataset." << std::endl;
 					freqnum++;
@@ -406,7 +406,8 @@ int main(int argc, char** argv) {
 				}
 				ft->setFreq(freqnum, freq.sBandName, freq.sRange);
 
-				auto db_ros_f_sorted = db_ros_f; // db_ros_f->sort(db::data_entries::MAX_DIMENSION_MM);
+				auto db_ros_f_sorted = db_ros_f->sort(std::vector<db::data_entries::data_entries_floats>(
+					1, db::data_entries::SDBR_MAX_DIMENSION_MM));
 
 				auto fgrp = scatdb::plugins::hdf5::openOrCreateGroup(filtbase, freq.sBandName.c_str());
 
@@ -469,7 +470,7 @@ int main(int argc, char** argv) {
 
 					// Bin the scattering database according to the profile boundaries
 					auto data = prof->getData();
-					vector < shared_ptr<const db> > binned_raw;
+					vector < shared_ptr<const db_view> > binned_raw;
 					vector<shared_ptr<const db::data_stats> > binned_stats;
 					Eigen::Matrix<float, Eigen::Dynamic, 1> parInts, parBks;
 					Eigen::Matrix<uint64_t, Eigen::Dynamic, 1> parCounts;
@@ -481,6 +482,16 @@ int main(int argc, char** argv) {
 					parCounts.setZero();
 					auto fpartials = scatdb::plugins::hdf5::openOrCreateGroup(fpro, "Bins");
 					const int w = ((int)log10(data->rows())) + 1;
+					// Select the rows for every size bin in one pass
+					vector<shared_ptr<const scatdb::filter> > binFilters;
+					for (int row = 0; row < data->rows(); ++row) {
+						auto fbin = filter::generate();
+						fbin->addFilterFloat(db::data_entries::SDBR_MAX_DIMENSION_MM,
+							(*data)(row, scatdb::profiles::defs::BIN_LOWER) / 1000.f,
+							(*data)(row, scatdb::profiles::defs::BIN_UPPER) / 1000.f);
+						binFilters.push_back(fbin);
+					}
+					auto binViews = filter::applyMany(binFilters, db_ros_f_sorted);
 					for (int row = 0; row < data->rows(); ++row) {
 						string strbin;
 						{
@@ -489,16 +500,18 @@ int main(int argc, char** argv) {
 							strbin = sstrbin.str();
 						}
 						auto obin = scatdb::plugins::hdf5::openOrCreateGroup(fpartials, strbin.c_str());
-						auto fbin = filter::generate();
 						float binMin = (*data)(row, scatdb::profiles::defs::BIN_LOWER) / 1000.f; // mm
 						float binMax = (*data)(row, scatdb::profiles::defs::BIN_UPPER) / 1000.f; // mm
 						float binMid = (*data)(row, scatdb::profiles::defs::BIN_MID) / 1000.f; // mm
 						float binWidth = binMax - binMin;
 						float binConc = (*data)(row, scatdb::profiles::defs::CONCENTRATION); // m^-4
-						fbin->addFilterFloat(db::data_entries::SDBR_MAX_DIMENSION_MM, binMin, binMax);
-						auto dbin = fbin->apply(db_ros_f_sorted);
+						auto dbin = binViews[row];
 						binned_raw.push_back(dbin);
-						auto sbin = dbin->getStats();
+						// Only the backscatter median and mean are needed, unless the full
+						// table is being written out.
+						auto sbin = (verb > 4) ? dbin->getStats() : dbin->getStats(db::stats_request(
+							1ULL << db::data_entries::SDBR_CBK_M,
+							(1ULL << db::data_entries::SDBR_MEDIAN) | (1ULL << db::data_entries::SDBR_MEAN)));
 						binned_stats.push_back(sbin);
 						
 						bandProfileObsCounts(i, row) = binConc;
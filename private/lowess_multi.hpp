@@ -0,0 +1,22 @@
+#pragma once
+#include "../scatdb/defs.hpp"
+#include <vector>
+#include <Eigen/Dense>
+
+namespace scatdb {
+	namespace regression {
+		/// Responses for lowessMulti. Row i holds every response at x[i].
+		typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> ResponseMatType;
+
+		/// LOWESS of several responses over the same x (see lowess.cpp).
+		/// The neighborhood windows depend only on x, so they are found once,
+		/// and the first pass fits every response with the same weights. The
+		/// robustness iterations reweight each response separately, so those
+		/// run with one response per thread.
+		/// The results are the same as running ::lowess on each column of y.
+		/// \param x must be in ascending order.
+		/// \param numThreads is the number of threads. Zero means one per core.
+		DLEXPORT_SDBR void lowessMulti(const std::vector<double> &x, const ResponseMatType &y,
+			double f, long nsteps, double delta, ResponseMatType &ys, size_t numThreads = 0);
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "../scatdb/defs.hpp"
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <vector>
+#include "../scatdb/debug.hpp"
+
+namespace scatdb {
+	namespace parallel {
+		/// Convert a requested thread count into an actual one. Zero means
+		/// one thread per hardware core. The result never exceeds maxUseful.
+		inline size_t resolveThreads(size_t requested, size_t maxUseful) {
+			size_t n = (requested) ? requested : debug::getConcurrentThreadsSupported();
+			n = std::min(n, maxUseful);
+			return (n) ? n : 1;
+		}
+
+		/// Run fn(t) for each t in [0, numWorkers). Worker zero runs on the
+		/// calling thread. The first exception thrown by any worker is rethrown
+		/// once all of them have finished.
+		template <class F>
+		void runWorkers(size_t numWorkers, F fn) {
+			if (numWorkers <= 1) {
+				fn((size_t)0);
+				return;
+			}
+			std::vector<std::exception_ptr> errs(numWorkers);
+			auto wrapped = [&](size_t t) {
+				try { fn(t); }
+				catch (...) { errs[t] = std::current_exception(); }
+			};
+			std::vector<std::thread> pool;
+			pool.reserve(numWorkers - 1);
+			for (size_t t = 1; t < numWorkers; ++t)
+				pool.push_back(std::thread(wrapped, t));
+			wrapped(0);
+			for (auto &th : pool) th.join();
+			for (auto &e : errs)
+				if (e) std::rethrow_exception(e);
+		}
+	}
+}
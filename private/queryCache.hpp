@@ -0,0 +1,81 @@
+#pragma once
+#include "../scatdb/defs.hpp"
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "../scatdb/hash.hpp"
+#include "../scatdb/scatdb.hpp"
+
+namespace scatdb {
+	/// Least recently used cache of query results (see filter::setCacheBudget).
+	/// Safe to call from several threads.
+	namespace queryCache {
+		/// What a cached result is. The kind is part of every key, so a hit
+		/// always has the type that the caller expects.
+		enum class kinds : uint64_t { APPLY, VIEW, STATS, REGRESS };
+
+		/// Builds a key out of 64-bit words
+		class HIDDEN_SDBR keyBuilder {
+			std::vector<uint64_t> words;
+		public:
+			explicit keyBuilder(kinds k) { words.push_back((uint64_t)k); }
+			keyBuilder& add(uint64_t v) { words.push_back(v); return *this; }
+			keyBuilder& add(const hash::HASH_t &h) { return add(h.lower).add(h.upper); }
+			keyBuilder& add(double v) {
+				uint64_t u;
+				std::memcpy(&u, &v, sizeof(u));
+				return add(u);
+			}
+			hash::HASH_t key() const;
+		};
+
+		/// Is the cache enabled (is the budget nonzero)?
+		HIDDEN_SDBR bool enabled();
+		/// The cached result, or nullptr
+		HIDDEN_SDBR std::shared_ptr<const scatdb_base> find(const hash::HASH_t&);
+		/// Add a result. Results larger than the budget are not kept.
+		HIDDEN_SDBR void insert(const hash::HASH_t&, std::shared_ptr<const scatdb_base>, uint64_t bytes);
+
+		/// A cached selection. Only the row numbers are kept, so that the cache
+		/// does not hold the parent database, or anything that a view later
+		/// caches, outside of the budget.
+		struct HIDDEN_SDBR cachedRows : public scatdb_base {
+			db::RowIdsType rows;
+		};
+
+		/// Sizes of the cached objects, for the budget. Each counts what the
+		/// entry keeps alive.
+		HIDDEN_SDBR uint64_t bytesOf(const db&);
+		HIDDEN_SDBR uint64_t bytesOf(const cachedRows&);
+		HIDDEN_SDBR uint64_t bytesOf(const db::data_stats&);
+
+		/// Look up a result, computing and caching it on a miss. makeKey returns
+		/// a keyBuilder, and is only called when the cache is enabled.
+		template <class T, class K, class F>
+		std::shared_ptr<const T> memoize(K makeKey, F compute) {
+			if (!enabled()) return compute();
+			const hash::HASH_t k = makeKey().key();
+			auto hit = find(k);
+			if (hit) return std::static_pointer_cast<const T>(hit);
+			std::shared_ptr<const T> res = compute();
+			insert(k, res, bytesOf(*res));
+			return res;
+		}
+
+		/// Like memoize, for a row selection. select fills in the rows that it
+		/// is given, and the caller wraps the result in a view of its own parent.
+		template <class K, class F>
+		db::RowIdsType memoizeRows(K makeKey, F select) {
+			db::RowIdsType rows;
+			if (!enabled()) {
+				select(rows);
+				return rows;
+			}
+			return memoize<cachedRows>(makeKey, [&]() {
+				std::shared_ptr<cachedRows> res(new cachedRows);
+				select(res->rows);
+				return std::shared_ptr<const cachedRows>(res);
+			})->rows;
+		}
+	}
+}
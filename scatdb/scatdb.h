@@ -58,6 +58,8 @@ extern "C" {
 	bool DLEXPORT_SDBR SDBR_writeDBtext(SDBR_HANDLE handle, const char* outfile);
 	bool DLEXPORT_SDBR SDBR_writeDBHDF(SDBR_HANDLE handle,
 		const char* outfile, enum SDBR_write_type wt, const char* hdfpath);
+	/// Write the database as a memory-mappable .sdbbin file
+	bool DLEXPORT_SDBR SDBR_writeDBbinary(SDBR_HANDLE handle, const char* outfile);
 	
 	/// Get number of entries in database
 	uint64_t DLEXPORT_SDBR SDBR_getNumRows(SDBR_HANDLE handle);
@@ -81,8 +83,33 @@ extern "C" {
 	/// Same options as for the float table.
 	bool DLEXPORT_SDBR SDBR_getIntTable(SDBR_HANDLE db, uint64_t* p, uint64_t maxsize);
 
-	/// Sort the database according to an axis
-	//SDBR_HANDLE DLEXPORT_SDBR SDBR_sortByFloat(SDBR_HANDLE db, data_entries_floats col_id);
+	/// Borrow a float column without copying it.
+	/// \param db is the pointer to the loaded database.
+	/// \param p receives the address of the first entry. Entry i is at p[i * stride].
+	/// \param length receives the number of entries.
+	/// \param stride receives the distance between entries, in floats (not bytes).
+	/// \note The memory belongs to the database. It stays valid until the handle is
+	/// freed, and it must not be written to.
+	bool DLEXPORT_SDBR SDBR_borrowFloatColumn(SDBR_HANDLE db, enum data_entries_floats col_id,
+		const float** p, uint64_t* length, uint64_t* stride);
+
+	/// Borrow an integer column without copying it.
+	/// Same options as for the float column. The stride is in integers.
+	bool DLEXPORT_SDBR SDBR_borrowIntColumn(SDBR_HANDLE db, enum data_entries_ints col_id,
+		const uint64_t** p, uint64_t* length, uint64_t* stride);
+
+	/// Borrow the whole float table without copying it.
+	/// The table is in row-major form, as in SDBR_getFloatTable, and has the same
+	/// lifetime rules as SDBR_borrowFloatColumn.
+	/// \param rows receives the number of records.
+	/// \param cols receives the number of floats in each record.
+	bool DLEXPORT_SDBR SDBR_borrowFloatTable(SDBR_HANDLE db, const float** p,
+		uint64_t* rows, uint64_t* cols);
+
+	/// Sort the database according to an axis. Ties are broken by max dimension
+	/// when sorting by aeff, and by aeff otherwise.
+	/// \returns A handle to a new, sorted copy of the database.
+	SDBR_HANDLE DLEXPORT_SDBR SDBR_sortByFloat(SDBR_HANDLE db, enum data_entries_floats col_id);
 
 	/// Filter the database according to a floating-point column
 	SDBR_HANDLE DLEXPORT_SDBR SDBR_filterFloatByString(SDBR_HANDLE db, enum data_entries_floats col_id, const char* strFilter);
@@ -92,6 +119,67 @@ extern "C" {
 	SDBR_HANDLE DLEXPORT_SDBR SDBR_filterIntByString(SDBR_HANDLE db, enum data_entries_ints col_id, const char* strFilter);
 	SDBR_HANDLE DLEXPORT_SDBR SDBR_filterIntByRange(SDBR_HANDLE db, enum data_entries_ints col_id, uint64_t minVal, uint64_t maxVal);
 
+	/// Count the rows that a filter would select, without creating a new
+	/// database. These take the same arguments as the SDBR_filter functions.
+	/// On error, they return zero and set the error message.
+	uint64_t DLEXPORT_SDBR SDBR_countFloatByString(SDBR_HANDLE db, enum data_entries_floats col_id, const char* strFilter);
+	uint64_t DLEXPORT_SDBR SDBR_countFloatByRange(SDBR_HANDLE db, enum data_entries_floats col_id, float minVal, float maxVal);
+	uint64_t DLEXPORT_SDBR SDBR_countIntByString(SDBR_HANDLE db, enum data_entries_ints col_id, const char* strFilter);
+	uint64_t DLEXPORT_SDBR SDBR_countIntByRange(SDBR_HANDLE db, enum data_entries_ints col_id, uint64_t minVal, uint64_t maxVal);
+
+	/// Integrate the database over many particle size distributions at once.
+	/// The rows are selected by frequency, temperature and flake type, binned by
+	/// maximum dimension, and each profile's concentrations are integrated against
+	/// the median backscatter and extinction cross sections of each bin.
+	/// \param db is the pointer to the loaded database.
+	/// \param freqMinGHz, freqMaxGHz, tempMinK and tempMaxK give the inclusive ranges of rows to use.
+	/// \param flaketypes lists the flake types to use. If numFlaketypes is zero, all are used.
+	/// \param binEdgesMM holds the numBins+1 ascending bin edges (maximum dimension, mm).
+	/// Bin i covers binEdgesMM[i] <= size < binEdgesMM[i+1].
+	/// \param conc holds numProfiles rows of numBins concentrations (m^-4), in row-major order.
+	/// \param backscatter receives the integrated backscatter of each profile (m^-1).
+	/// \param extinction receives the integrated extinction of each profile (m^-1).
+	/// \param ze receives the effective radar reflectivity of each profile (mm^6 m^-3).
+	/// Any of the three outputs may be NULL. Each holds numProfiles floats.
+	/// If no rows match the frequency, temperature and flake type selection,
+	/// every output is set to zero (Ze is linear, so zero means no echo) and
+	/// the call still succeeds.
+	bool DLEXPORT_SDBR SDBR_integratePSD(SDBR_HANDLE db,
+		float freqMinGHz, float freqMaxGHz, float tempMinK, float tempMaxK,
+		const uint64_t* flaketypes, uint64_t numFlaketypes,
+		const float* binEdgesMM, uint64_t numBins,
+		const float* conc, uint64_t numProfiles,
+		float* backscatter, float* extinction, float* ze);
+
+	/// Look up the scattering properties of many particles at once. The
+	/// database is gridded over frequency, temperature and size for each flake
+	/// type on the first call, and queries are answered by multilinear
+	/// interpolation (see scatdb::db::data_lookup).
+	/// \param db is the pointer to the loaded database.
+	/// \param sizeAxis is SDBR_AEFF_UM or SDBR_MAX_DIMENSION_MM.
+	/// \param flaketypes, freqGHz, tempK and sizes each hold numPoints values.
+	/// \param out receives 5 floats per point: cabs, cbk, cext, csca (m^2) and g.
+	/// Points that the database does not cover give NaN.
+	/// The lookup uses the thread count set by SDBR_setFilterThreads.
+	bool DLEXPORT_SDBR SDBR_lookupProperties(SDBR_HANDLE db,
+		enum data_entries_floats sizeAxis, uint64_t numPoints,
+		const uint64_t* flaketypes, const float* freqGHz, const float* tempK,
+		const float* sizes, float* out);
+
+	/// Set the number of threads used by the filter functions.
+	/// Zero uses one thread per hardware core. The default is one thread.
+	/// Results do not depend on the thread count.
+	bool DLEXPORT_SDBR SDBR_setFilterThreads(uint64_t numThreads);
+	/// Get the number of threads used by the filter functions.
+	uint64_t DLEXPORT_SDBR SDBR_getFilterThreads();
+
+	/// Set the number of bytes of filter, statistics and regression results
+	/// that are kept, so that repeated queries return at once. Zero (the
+	/// default) disables the cache.
+	bool DLEXPORT_SDBR SDBR_setQueryCacheBudget(uint64_t bytes);
+	/// Get the number of bytes of query results that may be kept.
+	uint64_t DLEXPORT_SDBR SDBR_getQueryCacheBudget();
+
 	/// Get the statistics table
 	/// \param db is the pointer to the data being summarized.
 	/// \param p is the pointer to the region of memory which will hold the table (floating point),
@@ -101,6 +189,13 @@ extern "C" {
 	/// \returns a bool which indicates whether the data are fully copied.
 	bool DLEXPORT_SDBR SDBR_getStats(SDBR_HANDLE db, float *p, uint64_t maxsize, uint64_t *count);
 
+	/// Get the statistics table, computing only some of its entries
+	/// \param columnMask selects the float columns. Bit j selects column j (see data_entries_floats).
+	/// \param statMask selects the statistics. Bit k selects statistic k (see data_entries_stats).
+	/// Entries that were not selected are NaN. The table has the same layout as in SDBR_getStats.
+	bool DLEXPORT_SDBR SDBR_getStatsSelected(SDBR_HANDLE db, uint64_t columnMask,
+		uint64_t statMask, float *p, uint64_t maxsize, uint64_t *count);
+
 	/// Get the size of the statistics table (in number of floats and in bytes).
 	/// This is a convenience function to help with memory allocations.
 	/// \param numFloats is the number of floats that must be allocated (pointer).
@@ -2,9 +2,12 @@
 #define SDBR_MAINPP
 
 #include "defs.hpp"
+#include "hashForwards.hpp"
 
+#include <map>
 #include <memory>
 #include <string>
+#include <vector>
 #include <Eigen/Dense>
 #include <cstdint>
 
@@ -15,23 +18,70 @@ namespace scatdb {
 	class DLEXPORT_SDBR scatdb_base { public: scatdb_base(); virtual ~scatdb_base(); };
 	class filter;
 	class filterImpl;
+	class db_view;
 	
 	class DLEXPORT_SDBR db : public scatdb_base {
 		friend class filter;
 		friend class filterImpl;
+		friend class db_view;
 		db();
 		static void readDBtext(std::shared_ptr<db>, const char* dbfile);
 		static void readDBhdf5(std::shared_ptr<db>, const char* dbfile, const char* hdfinternalpath = 0);
 		static void readDBscatdb(std::shared_ptr<db>, const char* dbfile = nullptr);
+		static void readDBbinary(std::shared_ptr<db>, const char* dbfile);
 	public:
 		virtual ~db();
+		/// Load a database. Files that are already loaded (same canonical path,
+		/// modification time, size and HDF5 group) are shared instead of being
+		/// read again. Safe to call from several threads.
 		static std::shared_ptr<const db> loadDB(const char* dbfile = 0, const char* hdfinternalpath = 0);
+		/// Restricts what loadDB reads. Bit j of floatColumns selects float
+		/// column j, and only rows [firstRow, firstRow + numRows) are kept.
+		/// Columns that are left out are filled with NaN (see loadColumns).
+		/// HDF5 files only read the selected hyperslabs. Other formats are read
+		/// in full and then trimmed.
+		struct DLEXPORT_SDBR load_options {
+			uint64_t floatColumns;
+			uint64_t firstRow, numRows;
+			/// Read everything
+			load_options();
+			load_options(uint64_t floatColumns, uint64_t firstRow = 0, uint64_t numRows = ~0ULL);
+			bool readsAll() const;
+		};
+		static std::shared_ptr<const db> loadDB(const char* dbfile, const char* hdfinternalpath,
+			const load_options&);
+		/// The float columns that hold data, as a bit mask (see load_options)
+		uint64_t loadedColumns() const;
+		/// Get a database with at least the given float columns read in. If
+		/// any are missing, the file is loaded again (through loadDB, so the
+		/// result is shared) with the same rows and the combined columns.
+		static std::shared_ptr<const db> loadColumns(std::shared_ptr<const db>, uint64_t floatColumns);
+		/// loadDB only keeps weak references to what it loads. Up to this many
+		/// bytes of the most recently used databases are also held, so that they
+		/// survive between uses. The default is zero.
+		static void setLoadCacheBudget(uint64_t bytes);
+		static uint64_t getLoadCacheBudget();
+		/// Hold a database in memory regardless of the budget, until it is unpinned
+		static void pin(std::shared_ptr<const db>);
+		static void unpin(std::shared_ptr<const db>);
+		/// Release everything held by the budget and by pinning
+		static void clearLoadCache();
 		static bool findDB(std::string& out);
 		void print(std::ostream &out) const;
 		void writeTextFile(const char* filename) const;
 		void writeHDFfile(const char* filename,
 			SDBR_write_type, const char* hdfinternalpath = nullptr) const;
 		void writeHDFfile(std::shared_ptr<H5::Group>) const;
+		/// Write a .sdbbin file. These are memory-mapped by loadDB, which reads
+		/// them without parsing. The column store uses the mapping in place,
+		/// but floatMat and intMat are still filled by copying (and
+		/// transposing) the whole table. The byte order is that of the
+		/// writing machine.
+		void writeBinaryFile(const char* filename) const;
+		/// Opt in to checking the checksum of .sdbbin files when they are
+		/// loaded. This reads the whole file, so it is off by default.
+		static void verifyBinaryChecksums(bool);
+		static bool verifyBinaryChecksums();
 
 		// The data in the database, in tabular form
 		struct DLEXPORT_SDBR data_entries {
@@ -44,22 +94,230 @@ namespace scatdb {
 		typedef Eigen::Matrix<uint64_t, Eigen::Dynamic, data_entries::SDBR_NUM_DATA_ENTRIES_INTS> IntMatType;
 		FloatMatType floatMat;
 		IntMatType intMat;
+		typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> PhaseMatType;
+		/// Phase functions, for sources that have them (Liu's scat_db2.dda).
+		/// Row i belongs to row i of floatMat, and the columns run from 0
+		/// (forward) to 180 degrees in 5 degree steps. Empty otherwise.
+		PhaseMatType phaseMat;
+		/// A list of row numbers. Selections made by filters are in ascending
+		/// order; a view's rows are in the view's order, which is not ascending
+		/// once the view has been sorted (see db_view::sort).
+		typedef std::vector<uint64_t> RowIdsType;
 
 		typedef Eigen::Matrix<float, data_entries::SDBR_NUM_DATA_ENTRIES_STATS,
 			data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS> StatsFloatType;
 
+		/// Selects the columns and the statistics that data_stats computes.
+		/// Bit j of columns selects float column j, and bit k of stats selects
+		/// statistic k (see data_entries_stats). Entries that were not requested
+		/// are set to NaN.
+		struct DLEXPORT_SDBR stats_request {
+			uint64_t columns, stats;
+			/// Request everything
+			stats_request();
+			stats_request(uint64_t columns, uint64_t stats);
+			bool wantColumn(int col) const;
+			bool wantStat(int stat) const;
+			bool operator<(const stats_request&) const;
+			bool operator==(const stats_request&) const;
+		};
+
+		struct data_stats_partial;
 		struct DLEXPORT_SDBR data_stats : public scatdb_base {
 			StatsFloatType floatStats;
 			uint64_t count;
+			/// What was computed
+			stats_request request;
 			std::shared_ptr<const db> srcdb;
 			void print(std::ostream&) const;
 			virtual ~data_stats();
-			static std::shared_ptr<const data_stats> generate(const db*);
+			static std::shared_ptr<const data_stats> generate(const db*,
+				const stats_request& = stats_request());
+			/// Generate the stats using only the listed rows
+			static std::shared_ptr<const data_stats> generate(const db*, const RowIdsType&,
+				const stats_request& = stats_request());
 			void writeHDF5File(std::shared_ptr<H5::Group>) const;
 		private:
+			friend struct data_stats_partial;
 			data_stats();
+			static std::shared_ptr<const data_stats> generate(const db*, const RowIdsType*,
+				const stats_request&);
 		};
 		std::shared_ptr<const data_stats> getStats() const;
+		/// Compute only the requested statistics. Each request is cached separately.
+		std::shared_ptr<const data_stats> getStats(const stats_request&) const;
+
+		/// Statistics that can be combined before they are finalized. Partials
+		/// built from separate sets of rows (chunks, bins or threads) can be
+		/// merged in any grouping without rescanning the rows. Medians come
+		/// from a quantile sketch. They are exact until a column holds more
+		/// than sketchSize values, and approximate after that.
+		struct DLEXPORT_SDBR data_stats_partial : public scatdb_base {
+			static const size_t sketchSize = 4096;
+			/// State for one column
+			struct column_state {
+				uint64_t n;
+				float mn, mx;
+				/// Mean, and the sums of the second to fourth powers of the
+				/// deviations from the mean
+				double mean, m2, m3, m4;
+				/// Sketch levels. Each value in level h stands for 2^h values.
+				std::vector<std::vector<float> > levels;
+				/// Which half each level kept at its last compaction
+				std::vector<bool> parity;
+				column_state();
+			};
+			/// Number of rows, including fill values
+			uint64_t count;
+			column_state cols[data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS];
+			/// Add every row of a database
+			void add(const db*);
+			/// Add the listed rows of a database
+			void add(const db*, const RowIdsType&);
+			/// Fold in the state from another partial
+			void merge(const data_stats_partial&);
+			std::shared_ptr<const data_stats> finalize() const;
+			virtual ~data_stats_partial();
+			/// An empty partial
+			static std::shared_ptr<data_stats_partial> generate();
+			static std::shared_ptr<data_stats_partial> generate(const db*);
+			static std::shared_ptr<data_stats_partial> generate(const db*, const RowIdsType&);
+		private:
+			data_stats_partial();
+			void add(const db*, const RowIdsType*);
+		};
+
+		/// Column-major copy of floatMat and intMat. Each column is held in its
+		/// own contiguous buffer, aligned to a 64-byte boundary, so that
+		/// single-column scans do not have to stride across entire rows.
+		struct DLEXPORT_SDBR data_columns : public scatdb_base {
+			typedef Eigen::Map<const Eigen::Matrix<float, Eigen::Dynamic, 1>, Eigen::Aligned16> FloatColType;
+			typedef Eigen::Map<const Eigen::Matrix<uint64_t, Eigen::Dynamic, 1>, Eigen::Aligned16> IntColType;
+			/// Alignment (in bytes) of the start of each column
+			static const size_t alignment = 64;
+			uint64_t rows;
+			const float* floatData(int col) const;
+			const uint64_t* intData(int col) const;
+			FloatColType floatCol(int col) const;
+			IntColType intCol(int col) const;
+			virtual ~data_columns();
+			static std::shared_ptr<const data_columns> generate(const db*);
+		private:
+			friend class db;
+			data_columns();
+			std::shared_ptr<char> backing;
+			const float* floatPtrs[data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS];
+			const uint64_t* intPtrs[data_entries::SDBR_NUM_DATA_ENTRIES_INTS];
+		};
+		/// Get the column store. It is generated on first use and then cached.
+		std::shared_ptr<const data_columns> getColumns() const;
+		/// Opt in to the column store. When enabled, loaded databases build their
+		/// column store immediately, and filtering, statistics and regression
+		/// read from the columns instead of striding across floatMat.
+		static void useColumnStore(bool);
+		static bool useColumnStore();
+
+		/// Sorted permutation of one float column, for answering range
+		/// predicates by binary search. NaN values are left out.
+		struct DLEXPORT_SDBR data_index : public scatdb_base {
+			int varnum;
+			/// The column values, in ascending order
+			std::vector<float> values;
+			/// rows[i] is the row holding values[i]
+			RowIdsType rows;
+			/// Number of entries with lo <= value <= hi
+			uint64_t count(float lo, float hi) const;
+			/// Append the rows with lo <= value <= hi to out, in value order
+			void find(float lo, float hi, RowIdsType &out) const;
+			virtual ~data_index();
+			static std::shared_ptr<const data_index> generate(const db*,
+				data_entries::data_entries_floats);
+		private:
+			data_index();
+			std::pair<size_t, size_t> bounds(float lo, float hi) const;
+		};
+		/// Get the index for a column. It is generated on first use and then cached.
+		std::shared_ptr<const data_index> getIndex(data_entries::data_entries_floats) const;
+		/// Opt in to index-assisted filtering. Indexes are only consulted for
+		/// the columns where isIndexed is true (frequency, temperature,
+		/// effective radius and maximum dimension).
+		static void useIndexes(bool);
+		static bool useIndexes();
+		static bool isIndexed(data_entries::data_entries_floats);
+
+		/// Rows of a database grouped into consecutive bins along one column.
+		/// Bin i covers edges[i] <= value < edges[i+1]. Rows outside of
+		/// every bin are left out.
+		struct DLEXPORT_SDBR data_bins : public scatdb_base {
+			int varnum;
+			std::vector<float> edges;
+			/// Row numbers, grouped by bin. Within each bin they keep the order
+			/// of the source, so they are ascending unless the source is a
+			/// sorted view. Bin i holds rows[offsets[i]] up to (but excluding)
+			/// rows[offsets[i+1]].
+			RowIdsType rows;
+			std::vector<uint64_t> offsets;
+			size_t numBins() const;
+			uint64_t count(size_t bin) const;
+			RowIdsType getRows(size_t bin) const;
+			virtual ~data_bins();
+			static std::shared_ptr<const data_bins> generate(const db*,
+				data_entries::data_entries_floats, const std::vector<float> &edges);
+			/// Bin only the listed rows
+			static std::shared_ptr<const data_bins> generate(const db*,
+				data_entries::data_entries_floats, const std::vector<float> &edges,
+				const RowIdsType&);
+		private:
+			data_bins();
+			static std::shared_ptr<const data_bins> generate(const db*,
+				data_entries::data_entries_floats, const std::vector<float> &edges,
+				const RowIdsType*);
+		};
+		/// Split the rows into bins along a column. The edges must be in
+		/// ascending order.
+		std::shared_ptr<const data_bins> binBy(data_entries::data_entries_floats,
+			const std::vector<float> &edges) const;
+		/// Statistics for each bin, in one pass over the rows
+		std::vector<std::shared_ptr<const data_stats> > binStats(
+			data_entries::data_entries_floats, const std::vector<float> &edges) const;
+
+		/// Bulk scattering properties of many particle size distributions.
+		/// The rows are binned by maximum dimension, and each profile's
+		/// concentrations are integrated against the median backscatter and
+		/// extinction cross sections of each bin. Empty bins contribute nothing.
+		/// \note The rows should be pre-filtered by temperature, frequency and
+		///   flake type, as for regress.
+		struct DLEXPORT_SDBR data_psd : public scatdb_base {
+			/// Bin edges, in mm
+			std::vector<float> edges;
+			/// Number of database rows in each bin
+			std::vector<uint64_t> binCounts;
+			/// Median backscatter and extinction cross sections in each bin (m^2)
+			std::vector<float> binCbk, binCext;
+			/// Median frequency of the rows, and its wavelength (m)
+			float frequencyGHz, wavelengthM;
+			/// |K_w|^2 of water at 273.15 K, at that frequency
+			float kw2;
+			/// One entry per profile: integrated backscatter (m^-1),
+			/// extinction (m^-1) and effective reflectivity (mm^6 m^-3)
+			std::vector<float> backscatter, extinction, ze;
+			virtual ~data_psd();
+			/// \param edges are the numBins+1 ascending bin edges, in mm.
+			///   Bin i covers edges[i] <= size < edges[i+1].
+			/// \param conc holds numProfiles rows of numBins concentrations (m^-4),
+			///   in row-major order.
+			static std::shared_ptr<const data_psd> generate(const db*,
+				const std::vector<float> &edges, const float* conc, size_t numProfiles);
+			static std::shared_ptr<const data_psd> generate(const db*, const RowIdsType&,
+				const std::vector<float> &edges, const float* conc, size_t numProfiles);
+		private:
+			data_psd();
+			static std::shared_ptr<const data_psd> generate(const db*, const RowIdsType*,
+				const std::vector<float> &edges, const float* conc, size_t numProfiles);
+		};
+		/// Integrate over particle size distributions. See data_psd.
+		std::shared_ptr<const data_psd> integratePSD(const std::vector<float> &edges,
+			const float* conc, size_t numProfiles) const;
 
 		/// Regression. See lowess.cpp. delta can equal xrange / 50.
 		/// The initial regression routine uses input x values in the output.
@@ -72,17 +330,231 @@ namespace scatdb {
 			db::data_entries::data_entries_floats xaxis = db::data_entries::SDBR_AEFF_UM,
 			double f = 0.1,
 			uint64_t nsteps = 2, double delta = 0.) const;
-		//std::shared_ptr<const db> interpolate(
-		//	db::data_entries::data_entries_floats xaxis = db::data_entries::SDBR_AEFF_UM
-		//	) const;
 
+		/// Spline through the scattering columns (cabs, cbk, cext, csca and g)
+		/// along a size axis. The cross sections are fitted in log10 space, as
+		/// in regress. The knots are sorted and deduplicated once (rows that
+		/// share an x value are averaged), and the coefficients of every column
+		/// are computed up front, so that any number of grids can be evaluated
+		/// without refitting. Rows with a NaN or fill value, or a cross section
+		/// that is not positive, are left out.
+		struct DLEXPORT_SDBR data_spline : public scatdb_base {
+			enum class spline_type {
+				/// Natural cubic spline (C2, may overshoot noisy data)
+				SDBR_CUBIC,
+				/// Monotone piecewise cubic Hermite (PCHIP, C1, no overshoot)
+				SDBR_PCHIP
+			};
+			int varnum;
+			spline_type type;
+			/// The knots, in ascending order
+			std::vector<double> x;
+			/// The response columns, in the order that they are fitted
+			static const int numResponses = 5;
+			static const int responseCols[numResponses];
+			/// One row per segment. Each response has four coefficients
+			/// (a, b, c, d), for a + b*t + c*t^2 + d*t^3 with t = x - x[segment].
+			Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> coeffs;
+			/// Evaluate at each grid point. The result has one row per point.
+			/// Columns that are not fitted, and points outside of the knots, are
+			/// set to the fill value (-999). Ascending grids take a single
+			/// forward walk over the segments. Other grids are binary searched.
+			std::shared_ptr<const db> evaluate(const std::vector<double> &grid) const;
+			/// n points from lo to hi, inclusive, evenly spaced
+			static std::vector<double> linearGrid(double lo, double hi, size_t n);
+			/// n points from lo to hi, inclusive, evenly spaced in log10(x)
+			static std::vector<double> logGrid(double lo, double hi, size_t n);
+			virtual ~data_spline();
+			static std::shared_ptr<const data_spline> generate(const db*,
+				data_entries::data_entries_floats xaxis, spline_type);
+			/// Fit only the listed rows
+			static std::shared_ptr<const data_spline> generate(const db*, const RowIdsType&,
+				data_entries::data_entries_floats xaxis, spline_type);
+		private:
+			data_spline();
+			static std::shared_ptr<const data_spline> generate(const db*, const RowIdsType*,
+				data_entries::data_entries_floats xaxis, spline_type);
+		};
+		/// The spline along xaxis. It is fitted on first use and then cached.
+		std::shared_ptr<const data_spline> getSpline(
+			data_entries::data_entries_floats xaxis = data_entries::SDBR_AEFF_UM,
+			data_spline::spline_type = data_spline::spline_type::SDBR_PCHIP) const;
+		/// Interpolate onto a regular grid over the range of xaxis, spaced
+		/// every 10 um for aeff and every 0.1 mm for max dimension.
+		std::shared_ptr<const db> interpolate(
+			db::data_entries::data_entries_floats xaxis = db::data_entries::SDBR_AEFF_UM,
+			data_spline::spline_type = data_spline::spline_type::SDBR_PCHIP
+			) const;
+		/// Interpolate onto the given grid (see data_spline::linearGrid and logGrid)
+		std::shared_ptr<const db> interpolate(const std::vector<double> &grid,
+			db::data_entries::data_entries_floats xaxis = db::data_entries::SDBR_AEFF_UM,
+			data_spline::spline_type = data_spline::spline_type::SDBR_PCHIP
+			) const;
+
+		/// Gridded scattering properties for fast point queries, in the manner
+		/// of the Liu tables but for every flake type in the database. For each
+		/// flake type, the rows are grouped by frequency and temperature, and
+		/// each group's PCHIP spline (see data_spline) is sampled on a
+		/// log-spaced size grid. Queries are answered by multilinear
+		/// interpolation over (frequency, temperature, log size). Cross
+		/// sections are interpolated in log10 space, as they are splined.
+		struct DLEXPORT_SDBR data_lookup : public scatdb_base {
+			/// The table of one flake type
+			struct table {
+				uint64_t flaketype;
+				/// Grid axes, ascending. sizes is log-spaced.
+				std::vector<float> freqs, temps, sizes;
+				/// Node values. The node at (i, j, k) holds the data_spline
+				/// responses, starting at ((i * temps.size() + j) * sizes.size() + k)
+				/// * nodeStride. Nodes that the data do not cover are NaN.
+				std::vector<float> values;
+			};
+			/// Each node is padded to this many floats, so that it fills one
+			/// vector register
+			static const size_t nodeStride = 8;
+			/// The size axis (aeff or max dimension)
+			int varnum;
+			std::vector<table> tables;
+			/// Look up n points. Point i is (flaketypes[i], freqGHz[i], tempK[i],
+			/// sizes[i]), and its cabs, cbk, cext, csca (m^2) and g are written
+			/// to out[5*i] to out[5*i+4]. Temperatures beyond the tabulated ones
+			/// are clamped, since most flake types have only one. Unknown flake
+			/// types and frequencies or sizes outside of the grid give NaN. A
+			/// point in a partly covered cell gives NaN if any uncovered corner
+			/// has a nonzero weight; points on a covered node or cell face are
+			/// answered from the covered corners alone.
+			/// \param numThreads is the number of threads. Zero means one per core.
+			void lookup(size_t n, const uint64_t* flaketypes, const float* freqGHz,
+				const float* tempK, const float* sizes, float* out, size_t numThreads = 1) const;
+			/// The table for a flake type, or nullptr
+			const table* findTable(uint64_t flaketype) const;
+			virtual ~data_lookup();
+			/// \param numSizes is the number of size nodes per flake type
+			static std::shared_ptr<const data_lookup> generate(const db*,
+				data_entries::data_entries_floats xaxis = data_entries::SDBR_AEFF_UM,
+				size_t numSizes = 128);
+			/// Grid only the listed rows
+			static std::shared_ptr<const data_lookup> generate(const db*, const RowIdsType&,
+				data_entries::data_entries_floats xaxis = data_entries::SDBR_AEFF_UM,
+				size_t numSizes = 128);
+		private:
+			data_lookup();
+			static std::shared_ptr<const data_lookup> generate(const db*, const RowIdsType*,
+				data_entries::data_entries_floats xaxis, size_t numSizes);
+		};
+		/// The lookup table along xaxis, with the default size grid. It is
+		/// built on first use and then cached.
+		std::shared_ptr<const data_lookup> getLookup(
+			data_entries::data_entries_floats xaxis = data_entries::SDBR_AEFF_UM) const;
+
+		/// Row order that sorts the table by the listed keys, in ascending order.
+		/// Ties on the first key are broken by the second, and so on. Rows that
+		/// tie on every key keep their order, and NaNs sort last.
+		RowIdsType sortPermutation(const std::vector<data_entries::data_entries_floats> &keys) const;
+		/// The listed rows, in sorted order. Only these rows are sorted.
+		RowIdsType sortPermutation(const std::vector<data_entries::data_entries_floats> &keys,
+			const RowIdsType &rows) const;
+		/// Copy of the table, sorted by the listed keys. See sortPermutation.
+		std::shared_ptr<const db> sort(const std::vector<data_entries::data_entries_floats> &keys) const;
+		/// Sort along xaxis. Ties are broken by max dimension when xaxis is
+		/// aeff, and by aeff otherwise.
 		std::shared_ptr<const db> sort(
 			db::data_entries::data_entries_floats xaxis = db::data_entries::SDBR_AEFF_UM
 			) const;
 	private:
 		mutable std::shared_ptr<const data_stats> pStats;
+		mutable std::map<stats_request, std::shared_ptr<const data_stats> > pStatsRequests;
+		mutable std::map<std::pair<int, int>, std::shared_ptr<const data_spline> > pSplines;
+		mutable std::shared_ptr<const data_lookup> pLookups[data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS];
+		mutable std::shared_ptr<const data_columns> pColumns;
+		mutable std::shared_ptr<const data_index> pIndices[data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS];
+		/// Copy the listed rows into a new database
+		static std::shared_ptr<db> gatherRows(const db*, const RowIdsType&);
+		/// Where a loaded database came from, so that more columns can be read later
+		std::string srcFile, srcGroup;
+		load_options srcOptions;
+		static void readDBhdf5(std::shared_ptr<db>, const char* dbfile, const char* hdfinternalpath,
+			const load_options&);
+		/// Unique to each database object, and never reused. Query results are
+		/// cached under this (see filter::setCacheBudget).
+		uint64_t serial;
 	};
 	typedef std::shared_ptr<const db> db_t;
+
+	/// A selection of rows from a database, without copying them. The rows
+	/// are only copied when materialize() is called. Views are produced by
+	/// filter::applyView, and a view of a view still refers to the original
+	/// database.
+	class DLEXPORT_SDBR db_view : public scatdb_base {
+		friend class filter;
+		db_view();
+		std::shared_ptr<const db> parent;
+		db::RowIdsType rows;
+		mutable std::shared_ptr<const db::data_stats> pStats;
+		mutable std::map<db::stats_request, std::shared_ptr<const db::data_stats> > pStatsRequests;
+		mutable std::map<std::pair<int, int>, std::shared_ptr<const db::data_spline> > pSplines;
+		mutable std::shared_ptr<const db::data_lookup> pLookups[db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS];
+		mutable std::shared_ptr<const db> pMaterialized;
+		mutable hash::HASH_p pRowsHash;
+		/// Hash of the selected rows. Views of the same rows of the same
+		/// database share cached results through it.
+		hash::HASH_p rowsHash() const;
+	public:
+		virtual ~db_view();
+		/// Select all rows of a database
+		static std::shared_ptr<const db_view> generate(std::shared_ptr<const db>);
+		/// Select the listed rows of a database
+		static std::shared_ptr<const db_view> generate(std::shared_ptr<const db>, const db::RowIdsType&);
+		std::shared_ptr<const db> getParent() const;
+		/// The selected rows, as row numbers in the parent database, in the
+		/// view's order. This is ascending for unsorted selections.
+		const db::RowIdsType& getRows() const;
+		uint64_t numRows() const;
+		/// Copy the selected rows into a standalone database. The copy is cached.
+		std::shared_ptr<const db> materialize() const;
+		std::shared_ptr<const db::data_stats> getStats() const;
+		std::shared_ptr<const db::data_stats> getStats(const db::stats_request&) const;
+		/// Split the selected rows into bins along a column. See db::binBy.
+		std::shared_ptr<const db::data_bins> binBy(db::data_entries::data_entries_floats,
+			const std::vector<float> &edges) const;
+		/// One view for each bin
+		std::vector<std::shared_ptr<const db_view> > binViews(
+			db::data_entries::data_entries_floats, const std::vector<float> &edges) const;
+		std::vector<std::shared_ptr<const db::data_stats> > binStats(
+			db::data_entries::data_entries_floats, const std::vector<float> &edges) const;
+		/// Integrate over particle size distributions. See db::data_psd.
+		std::shared_ptr<const db::data_psd> integratePSD(const std::vector<float> &edges,
+			const float* conc, size_t numProfiles) const;
+		/// The same rows, reordered by the listed keys. See db::sortPermutation.
+		std::shared_ptr<const db_view> sort(
+			const std::vector<db::data_entries::data_entries_floats> &keys) const;
+		/// Spline over the selected rows. See db::data_spline.
+		std::shared_ptr<const db::data_spline> getSpline(
+			db::data_entries::data_entries_floats xaxis = db::data_entries::SDBR_AEFF_UM,
+			db::data_spline::spline_type = db::data_spline::spline_type::SDBR_PCHIP) const;
+		/// Interpolate the selected rows. See db::interpolate.
+		std::shared_ptr<const db> interpolate(
+			db::data_entries::data_entries_floats xaxis = db::data_entries::SDBR_AEFF_UM,
+			db::data_spline::spline_type = db::data_spline::spline_type::SDBR_PCHIP) const;
+		std::shared_ptr<const db> interpolate(const std::vector<double> &grid,
+			db::data_entries::data_entries_floats xaxis = db::data_entries::SDBR_AEFF_UM,
+			db::data_spline::spline_type = db::data_spline::spline_type::SDBR_PCHIP) const;
+		/// Lookup table over the selected rows. See db::data_lookup.
+		std::shared_ptr<const db::data_lookup> getLookup(
+			db::data_entries::data_entries_floats xaxis = db::data_entries::SDBR_AEFF_UM) const;
+		/// Regression over the selected rows. See db::regress.
+		std::shared_ptr<const db> regress(
+			db::data_entries::data_entries_floats xaxis = db::data_entries::SDBR_AEFF_UM,
+			double f = 0.1,
+			uint64_t nsteps = 2, double delta = 0.) const;
+		void print(std::ostream &out) const;
+		void writeTextFile(const char* filename) const;
+		void writeHDFfile(const char* filename,
+			SDBR_write_type, const char* hdfinternalpath = nullptr) const;
+		void writeHDFfile(std::shared_ptr<H5::Group>) const;
+		void writeBinaryFile(const char* filename) const;
+	};
+	typedef std::shared_ptr<const db_view> db_view_t;
 	class DLEXPORT_SDBR filter : public scatdb_base {
 	private:
 		std::shared_ptr<filterImpl> p;
@@ -106,8 +578,61 @@ namespace scatdb {
 		//void addSortFloat(db::data_entries::data_entries_floats param, sortDir);
 		//void addSortInt(db::data_entries::data_entries_ints param, sortDir);
 
+		/// Convert the interval sets into vectorized predicate kernels.
+		/// This happens automatically on first use, and again after any
+		/// filter is added.
+		void compile() const;
+		/// Hash of the compiled predicates. The interval sets are sorted and
+		/// merged first, so filters that select the same rows in every database
+		/// (such as flake types "20,21,22" and "22,20,21") have the same hash.
+		hash::HASH_p queryHash() const;
+		/// The results of apply, applyView, getStats and regress are kept in a
+		/// least recently used cache with this many bytes, keyed by the source
+		/// database, the query hash and the call parameters. Repeated queries
+		/// return the cached objects. The default is zero, which disables it.
+		/// For applyView only the selected row numbers are cached, so the
+		/// cache never holds a database alive; each call returns a new view.
+		static void setCacheBudget(uint64_t bytes);
+		static uint64_t getCacheBudget();
+		/// Release every cached result
+		static void clearCache();
+		/// Number of threads used to evaluate the filter. Zero uses one thread
+		/// per hardware core. Results are identical for any thread count.
+		void setThreads(size_t);
+		size_t getThreads() const;
+		/// The thread count given to newly generated filters (initially 1)
+		static void setDefaultThreads(size_t);
+		static size_t getDefaultThreads();
 		std::shared_ptr<const db> apply(std::shared_ptr<const db>) const;
 		std::shared_ptr<const db> apply(const db*) const;
+		/// Like apply, but returns a view instead of copying the passing rows.
+		std::shared_ptr<const db_view> applyView(std::shared_ptr<const db>) const;
+		/// Filter an existing view. Only the rows of the view are examined.
+		std::shared_ptr<const db_view> applyView(std::shared_ptr<const db_view>) const;
+
+		/// Number of rows that pass. Nothing is copied, and no row list is built.
+		uint64_t count(std::shared_ptr<const db>) const;
+		uint64_t count(const db*) const;
+		/// Number of rows of an existing view that pass
+		uint64_t count(std::shared_ptr<const db_view>) const;
+		/// Does any row pass? The scan stops at the first chunk with a match.
+		bool any(std::shared_ptr<const db>) const;
+		bool any(const db*) const;
+		bool any(std::shared_ptr<const db_view>) const;
+
+		/// Evaluate several filters in a single pass over the rows. Result i
+		/// holds the rows that pass filters[i].
+		static std::vector<std::shared_ptr<const db_view> > applyMany(
+			const std::vector<std::shared_ptr<const filter> > &filters, std::shared_ptr<const db>);
+		static std::vector<std::shared_ptr<const db_view> > applyMany(
+			const std::vector<std::shared_ptr<const filter> > &filters, std::shared_ptr<const db_view>);
+		/// Like applyMany, but returns the passing row numbers of src
+		static std::vector<db::RowIdsType> applyManyRows(
+			const std::vector<std::shared_ptr<const filter> > &filters, const db*);
+	private:
+		std::shared_ptr<const db> applyUncached(const db*) const;
+		static std::vector<const filterImpl*> getImpls(
+			const std::vector<std::shared_ptr<const filter> > &filters);
 	};
 }
 
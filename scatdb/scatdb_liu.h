@@ -32,3 +32,32 @@ DLEXPORT_SDBR int liu_scatdb_onlyread(
 #define NFREQ		22   /* number of frequencies */
 #define NSIZE		20   /* max number of sizes */
 #define NQ		37   /* number of anges in PF */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* The decoded contents of scat_db2.dda. Dimensions are as in liu_scatdb_onlyread. */
+struct liu_scatdb_tables {
+	float fs[NFREQ], ts[NTEMP], szs[NSIZE][NSHAP], abss[NFREQ][NTEMP][NSHAP][NSIZE],
+		scas[NFREQ][NTEMP][NSHAP][NSIZE],
+		bscs[NFREQ][NTEMP][NSHAP][NSIZE], gs[NFREQ][NTEMP][NSHAP][NSIZE],
+		reff[NSIZE][NSHAP], pqs[NFREQ][NTEMP][NSHAP][NSIZE][NQ];
+	int shs[NSHAP], mf, mt, msh, msz[NSHAP];
+};
+/* Read and decode a scat_db2.dda file in one pass. Returns 0 on success,
+ * 2000 if the file cannot be read, and 3000 if it is truncated or its
+ * dimensions exceed the table sizes. */
+DLEXPORT_SDBR int liu_scatdb_readtables(const char* filename, struct liu_scatdb_tables* out);
+/* Batched, thread-safe version of liu_scatdb for n particles. The database
+ * is loaded once per location (as set by _set_scatdb_location) and shared
+ * by all threads. After the first call, no lock is taken, so this may be
+ * called from OpenMP regions. Inputs and
+ * outputs are arrays of length n, except p, which holds n*NQ values. Any
+ * output may be NULL to skip it. iret[i] receives the same status codes as
+ * liu_scatdb. Returns 0, or 2000 or 3000 if the database cannot be loaded. */
+DLEXPORT_SDBR int liu_scatdb_batch(int n, const float* f, const float* t, const int* nshape,
+	const float* dmax, float* cabs, float* csca, float* cbsc, float* g, float* p,
+	float* re, int* iret);
+#ifdef __cplusplus
+};
+#endif
@@ -69,6 +69,20 @@ namespace scatdb
 				("help-full", "Print out all possible program options")
 				("close-on-finish", po::value<bool>(), "Should the app automatically close on termination?")
 
+				("column-store", po::value<bool>(), "Keep a column-major copy of the loaded "
+				 "database to speed up filtering and statistics. Uses extra memory.")
+				("db-indexes", po::value<bool>(), "Build sorted indexes on frequency, "
+				 "temperature, effective radius and maximum dimension, and use them "
+				 "to speed up narrow filters.")
+				("filter-threads", po::value<size_t>(), "Number of threads used when "
+				 "filtering the database. Zero uses all hardware threads.")
+				("db-cache-mb", po::value<uint64_t>(), "Keep up to this many megabytes "
+				 "of recently loaded databases in memory, so that loading them again "
+				 "is free.")
+				("query-cache-mb", po::value<uint64_t>(), "Keep up to this many megabytes "
+				 "of filter, statistics and regression results in memory, so that "
+				 "repeated queries are free.")
+
 				("log-level-console-threshold", po::value<int>()->default_value((int)::scatdb::logging::WARNING), "Threshold for console logging")
 				//("log-channel", po::value<std::vector<std::string> >()->multitoken(), "Log only the specified channel(s)")
 				("log-file", po::value<std::string>(), "Log everything to specified file.")
@@ -197,6 +211,17 @@ namespace scatdb
 				std::cerr << spreambles;
 			}
 
+			if (vm.count("column-store"))
+				db::useColumnStore(vm["column-store"].as<bool>());
+			if (vm.count("db-indexes"))
+				db::useIndexes(vm["db-indexes"].as<bool>());
+			if (vm.count("filter-threads"))
+				filter::setDefaultThreads(vm["filter-threads"].as<size_t>());
+			if (vm.count("db-cache-mb"))
+				db::setLoadCacheBudget(vm["db-cache-mb"].as<uint64_t>() * 1024 * 1024);
+			if (vm.count("query-cache-mb"))
+				filter::setCacheBudget(vm["query-cache-mb"].as<uint64_t>() * 1024 * 1024);
+
 			std::string dbfile;
 			if (vm.count("dbfile")) dbfile = vm["dbfile"].as<string>();
 			db::findDB(dbfile);
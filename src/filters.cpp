@@ -1,18 +1,207 @@
 #include "../scatdb/defs.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <iostream>
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "../scatdb/error.hpp"
+#include "../scatdb/hash.hpp"
 #include "../scatdb/splitSet.hpp"
 #include "../scatdb/scatdb.hpp"
+#include "../private/parallel.hpp"
+#include "../private/queryCache.hpp"
+
+namespace {
+	/// Rows are evaluated in chunks of this size. Each chunk's predicate
+	/// results are held as a bitmask, one bit per row.
+	const size_t chunkRows = 1024;
+	const size_t chunkWords = chunkRows / 64;
+	const uint64_t signBit = 0x8000000000000000ULL;
+	/// Thread count given to newly generated filters
+	std::atomic<size_t> defaultThreads(1);
+
+	inline int popcount64(uint64_t v) {
+#if defined(_MSC_VER)
+		return (int)__popcnt64(v);
+#else
+		return __builtin_popcountll(v);
+#endif
+	}
+
+	inline int ctz64(uint64_t v) {
+#if defined(_MSC_VER)
+		unsigned long idx;
+		_BitScanForward64(&idx, v);
+		return (int)idx;
+#else
+		return __builtin_ctzll(v);
+#endif
+	}
+
+	/// Test up to 64 values against a set of closed ranges [lo, hi].
+	/// Bit k of the result is set if v[k] falls in any range.
+	uint64_t rangeBits(const float* v, size_t count,
+		const float* lo, const float* hi, size_t numRanges) {
+		uint64_t bits = 0;
+		size_t k = 0;
+#if defined(__AVX2__)
+		for (; k + 8 <= count; k += 8) {
+			const __m256 x = _mm256_loadu_ps(v + k);
+			__m256 acc = _mm256_setzero_ps();
+			for (size_t r = 0; r < numRanges; ++r) {
+				const __m256 ge = _mm256_cmp_ps(x, _mm256_set1_ps(lo[r]), _CMP_GE_OQ);
+				const __m256 le = _mm256_cmp_ps(x, _mm256_set1_ps(hi[r]), _CMP_LE_OQ);
+				acc = _mm256_or_ps(acc, _mm256_and_ps(ge, le));
+			}
+			bits |= (uint64_t)(unsigned)_mm256_movemask_ps(acc) << k;
+		}
+#elif defined(__SSE2__) || defined(_M_X64)
+		for (; k + 4 <= count; k += 4) {
+			const __m128 x = _mm_loadu_ps(v + k);
+			__m128 acc = _mm_setzero_ps();
+			for (size_t r = 0; r < numRanges; ++r) {
+				const __m128 ge = _mm_cmpge_ps(x, _mm_set1_ps(lo[r]));
+				const __m128 le = _mm_cmple_ps(x, _mm_set1_ps(hi[r]));
+				acc = _mm_or_ps(acc, _mm_and_ps(ge, le));
+			}
+			bits |= (uint64_t)(unsigned)_mm_movemask_ps(acc) << k;
+		}
+#endif
+		for (; k < count; ++k) {
+			unsigned in = 0;
+			for (size_t r = 0; r < numRanges; ++r)
+				in |= (unsigned)((v[k] >= lo[r]) & (v[k] <= hi[r]));
+			bits |= (uint64_t)in << k;
+		}
+		return bits;
+	}
+
+	uint64_t rangeBits(const uint64_t* v, size_t count,
+		const uint64_t* lo, const uint64_t* hi, size_t numRanges) {
+		uint64_t bits = 0;
+		size_t k = 0;
+#if defined(__AVX2__)
+		// AVX2 only has a signed 64-bit compare, so flip the sign bits first.
+		const __m256i flip = _mm256_set1_epi64x((long long)signBit);
+		for (; k + 4 <= count; k += 4) {
+			const __m256i x = _mm256_xor_si256(
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + k)), flip);
+			__m256i acc = _mm256_setzero_si256();
+			for (size_t r = 0; r < numRanges; ++r) {
+				const __m256i l = _mm256_set1_epi64x((long long)(lo[r] ^ signBit));
+				const __m256i h = _mm256_set1_epi64x((long long)(hi[r] ^ signBit));
+				const __m256i outside = _mm256_or_si256(
+					_mm256_cmpgt_epi64(l, x), _mm256_cmpgt_epi64(x, h));
+				acc = _mm256_or_si256(acc, _mm256_andnot_si256(outside, _mm256_set1_epi64x(-1)));
+			}
+			bits |= (uint64_t)(unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(acc)) << k;
+		}
+#endif
+		for (; k < count; ++k) {
+			unsigned in = 0;
+			for (size_t r = 0; r < numRanges; ++r)
+				in |= (unsigned)((v[k] >= lo[r]) & (v[k] <= hi[r]));
+			bits |= (uint64_t)in << k;
+		}
+		return bits;
+	}
+
+	/// AND the predicate results for n contiguous values into the chunk mask.
+	template <class T>
+	void maskChunk(const T* v, size_t n, const std::vector<T> &lo,
+		const std::vector<T> &hi, uint64_t* mask) {
+		for (size_t w = 0; w * 64 < n; ++w) {
+			if (!mask[w]) continue;
+			const size_t count = std::min<size_t>(64, n - (w * 64));
+			mask[w] &= rangeBits(v + (w * 64), count, lo.data(), hi.data(), lo.size());
+		}
+	}
+}
+
+namespace {
+	/// Does the closed range starting at lo continue one ending at hi? Floats
+	/// continue at the next representable value, and integers at hi + 1.
+	inline bool continues(float hi, float lo) {
+		return lo <= std::nextafter(hi, std::numeric_limits<float>::infinity());
+	}
+	inline bool continues(uint64_t hi, uint64_t lo) {
+		return (hi == std::numeric_limits<uint64_t>::max()) || (lo <= hi + 1);
+	}
+
+	/// Put closed ranges into canonical form: empty ranges are dropped, and
+	/// the rest are sorted and merged where they overlap or touch. The
+	/// selected values are unchanged.
+	template <class T>
+	void canonicalize(std::vector<T> &lo, std::vector<T> &hi) {
+		std::vector<std::pair<T, T> > r;
+		for (size_t i = 0; i < lo.size(); ++i)
+			if (lo[i] <= hi[i]) r.push_back(std::make_pair(lo[i], hi[i]));
+		std::sort(r.begin(), r.end());
+		lo.clear();
+		hi.clear();
+		for (const auto &p : r) {
+			if (lo.size() && continues(hi.back(), p.first)) {
+				hi.back() = std::max(hi.back(), p.second);
+				continue;
+			}
+			lo.push_back(p.first);
+			hi.push_back(p.second);
+		}
+	}
+
+	inline uint64_t hashWord(float v) {
+		uint32_t u;
+		std::memcpy(&u, &v, sizeof(u));
+		return (uint64_t)u;
+	}
+	inline uint64_t hashWord(uint64_t v) { return v; }
+
+	/// Append one column's ranges to the words that are hashed
+	template <class T>
+	void appendWords(uint64_t type, int varnum, const std::vector<T> &lo,
+		const std::vector<T> &hi, std::vector<uint64_t> &words) {
+		words.push_back(type);
+		words.push_back((uint64_t)varnum);
+		words.push_back((uint64_t)lo.size());
+		for (size_t i = 0; i < lo.size(); ++i) {
+			words.push_back(hashWord(lo[i]));
+			words.push_back(hashWord(hi[i]));
+		}
+	}
+}
 
 namespace scatdb {
+	/// The interval sets of a filter, rewritten as closed ranges [lo, hi]
+	/// so that every test is two comparisons with no special cases.
+	struct compiledPredicates {
+		template <class T>
+		struct column {
+			int varnum;
+			std::vector<T> lo, hi;
+		};
+		std::vector<column<float> > floats;
+		std::vector<column<uint64_t> > ints;
+		/// Hash of the ranges above (see filter::queryHash)
+		uint64_t hashLower, hashUpper;
+	};
+
 	class filterImpl {
 	public:
 		~filterImpl() {}
 	private:
 		friend class filter;
-		filterImpl() {
+		filterImpl() : numThreads(defaultThreads) {
 			floatFilters.resize(db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS);
 			intFilters.resize(db::data_entries::SDBR_NUM_DATA_ENTRIES_INTS);
 		}
@@ -25,6 +214,47 @@ namespace scatdb {
 			int varnum;
 		};
 		std::vector<sortType> sorts;
+		size_t numThreads;
+		mutable std::mutex m_compile;
+		mutable std::shared_ptr<const compiledPredicates> pCompiled;
+		size_t numFilters() const;
+		/// Get the compiled predicates, building them if needed
+		std::shared_ptr<const compiledPredicates> compile() const;
+		/// Drop the compiled predicates after the interval sets change
+		void invalidate();
+		/// Evaluate the predicates over one chunk of rows. Bit i of mask is
+		/// set if row start + i passes. Returns the number of mask words, or
+		/// zero if no row passes.
+		size_t evalChunk(const db* src, const db::data_columns* cols,
+			const db::RowIdsType* within, size_t start, size_t n,
+			const compiledPredicates &preds, uint64_t* mask) const;
+		/// Evaluate the predicates over one chunk of rows, appending the
+		/// passing row numbers to out.
+		void selectChunk(const db* src, const db::data_columns* cols,
+			const db::RowIdsType* within, size_t start, size_t n,
+			const compiledPredicates &preds, db::RowIdsType &out) const;
+		/// Count the rows that pass, without recording which ones. If
+		/// stopAtFirst is set, the count stops early once it is nonzero.
+		uint64_t countRows(const db* src, const db::RowIdsType* within, bool stopAtFirst) const;
+		/// Use the sorted column indexes to narrow the rows that need to be
+		/// scanned. Returns false if no indexed predicate is selective enough,
+		/// in which case candidates is left untouched.
+		bool planIndexed(const db* src, const db::RowIdsType* within,
+			const compiledPredicates &preds, db::RowIdsType &candidates) const;
+		/// Evaluate the predicates, splitting the rows into contiguous blocks of
+		/// chunks with one block per worker. Each worker's passing rows are
+		/// written to its own part, so concatenating the parts gives the
+		/// rows in their original order.
+		void selectParts(const db* src, const db::RowIdsType* within,
+			std::vector<db::RowIdsType> &parts) const;
+		/// Evaluate several filters in one pass. Each chunk of rows is gathered
+		/// once, and predicates shared between filters are evaluated once.
+		static void selectMany(const std::vector<const filterImpl*> &filters,
+			const db* src, const db::RowIdsType* within, std::vector<db::RowIdsType> &out);
+		/// Evaluate the predicates over the rows of src. If within is set, only
+		/// those rows are examined. The passing row numbers are written to out,
+		/// in their original order.
+		void selectRows(const db* src, const db::RowIdsType* within, db::RowIdsType &out) const;
 	};
 
 	/*
@@ -52,10 +282,12 @@ namespace scatdb {
 
 	void filter::addFilterFloat(db::data_entries::data_entries_floats param, float minval, float maxval) {
 		p->floatFilters[param].ranges.push_back(std::pair<float, float>(minval, maxval));
+		p->invalidate();
 	}
 
 	void filter::addFilterInt(db::data_entries::data_entries_ints param, uint64_t minval, uint64_t maxval) {
 		p->intFilters[param].ranges.push_back(std::pair<uint64_t,uint64_t>(minval,maxval));
+		p->invalidate();
 	}
 
 	template<>
@@ -70,10 +302,12 @@ namespace scatdb {
 
 	void filter::addFilterFloat(db::data_entries::data_entries_floats param, const std::string &rng) {
 		p->floatFilters[param].append(rng);
+		p->invalidate();
 	}
 
 	void filter::addFilterInt(db::data_entries::data_entries_ints param, const std::string &rng) {
 		p->intFilters[param].append(rng);
+		p->invalidate();
 	}
 
 	template<>
@@ -86,63 +320,563 @@ namespace scatdb {
 		addFilterInt((db::data_entries::data_entries_ints) param, rng);
 	}
 
-	std::shared_ptr<const db> filter::apply(const db* src) const {
-		std::shared_ptr<db> res(new db), presort(new db);
-		presort->floatMat.resize(src->floatMat.rows(), src->floatMat.cols());
-		presort->intMat.resize(src->intMat.rows(), src->intMat.cols());
+	size_t filterImpl::numFilters() const {
+		size_t numFilters = 0;
+		for (int j = 0; j < db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j) {
+			numFilters += (floatFilters[j].ranges.size());
+		}
+		for (int j = 0; j < db::data_entries::SDBR_NUM_DATA_ENTRIES_INTS; ++j) {
+			numFilters += intFilters[j].ranges.size();
+		}
+		return numFilters;
+	}
 
-		res->floatMat.resize(src->floatMat.rows(), src->floatMat.cols());
-		res->intMat.resize(src->intMat.rows(), src->intMat.cols());
-		//std::cerr << "fm " << src->floatMat.rows() << "x" << src->floatMat.cols()
-		//	<< "  im " << src->intMat.rows() << "x" << src->intMat.cols() << std::endl;
-		int numLines = (int)res->floatMat.rows();
-		int totLines = 0;
+	void filterImpl::invalidate() {
+		std::lock_guard<std::mutex> lock(m_compile);
+		pCompiled.reset();
+	}
 
-		// Count number of filters. If zero, then can optimize.
-		size_t numFilters = 0;
+	std::shared_ptr<const compiledPredicates> filterImpl::compile() const {
+		std::lock_guard<std::mutex> lock(m_compile);
+		if (pCompiled) return pCompiled;
+		std::shared_ptr<compiledPredicates> res(new compiledPredicates);
+		// inRange accepts first <= val < second, or val == first when the
+		// bounds are equal. Both become a closed range.
 		for (int j = 0; j < db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j) {
-			numFilters += (p->floatFilters[j].ranges.size());
+			if (!floatFilters[j].ranges.size()) continue;
+			compiledPredicates::column<float> c;
+			c.varnum = j;
+			for (const auto &r : floatFilters[j].ranges) {
+				c.lo.push_back(r.first);
+				if (r.first == r.second) c.hi.push_back(r.first);
+				else c.hi.push_back(std::nextafter(r.second,
+					-std::numeric_limits<float>::infinity()));
+			}
+			res->floats.push_back(std::move(c));
 		}
 		for (int j = 0; j < db::data_entries::SDBR_NUM_DATA_ENTRIES_INTS; ++j) {
-			numFilters += p->intFilters[j].ranges.size();
+			if (!intFilters[j].ranges.size()) continue;
+			compiledPredicates::column<uint64_t> c;
+			c.varnum = j;
+			for (const auto &r : intFilters[j].ranges) {
+				if (r.first == r.second) {
+					c.lo.push_back(r.first);
+					c.hi.push_back(r.first);
+				} else if (r.first < r.second) {
+					c.lo.push_back(r.first);
+					c.hi.push_back(r.second - 1);
+				} else {
+					// Never matches
+					c.lo.push_back(1);
+					c.hi.push_back(0);
+				}
+			}
+			res->ints.push_back(std::move(c));
+		}
+		// Canonical ranges give the same hash for equivalent filters, and
+		// fewer comparisons per row. A column with no ranges left never matches.
+		std::vector<uint64_t> words;
+		for (auto &c : res->floats) {
+			canonicalize(c.lo, c.hi);
+			appendWords(0, c.varnum, c.lo, c.hi, words);
+		}
+		for (auto &c : res->ints) {
+			canonicalize(c.lo, c.hi);
+			appendWords(1, c.varnum, c.lo, c.hi, words);
+		}
+		const auto h = hash::HASH(words.data(), (int)(words.size() * sizeof(uint64_t)));
+		res->hashLower = h->lower;
+		res->hashUpper = h->upper;
+		pCompiled = res;
+		return pCompiled;
+	}
+
+	namespace {
+		/// Mask with one bit set for each of the n rows in a chunk
+		size_t initMask(size_t n, uint64_t* mask) {
+			const size_t numWords = (n + 63) / 64;
+			for (size_t w = 0; w < numWords; ++w) mask[w] = ~0ULL;
+			if (n % 64) mask[numWords - 1] = (1ULL << (n % 64)) - 1;
+			return numWords;
+		}
+
+		/// The kernels need contiguous values. The column store provides these
+		/// directly; otherwise the chunk's values are gathered into buf.
+		const float* chunkValues(const db* src, const db::data_columns* cols,
+			const db::RowIdsType* within, size_t start, size_t n, int varnum, float* buf) {
+			if (cols) {
+				const float* col = cols->floatData(varnum);
+				if (!within) return col + start;
+				for (size_t i = 0; i < n; ++i) buf[i] = col[(*within)[start + i]];
+			} else {
+				const float* base = src->floatMat.data() + varnum;
+				const size_t stride = db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS;
+				if (within) for (size_t i = 0; i < n; ++i) buf[i] = base[(*within)[start + i] * stride];
+				else for (size_t i = 0; i < n; ++i) buf[i] = base[(start + i) * stride];
+			}
+			return buf;
 		}
 
-		if (numFilters) {
-			// Apply filter operation to each row
-			for (size_t i = 0; i < numLines; ++i) {
-				auto floatLine = src->floatMat.block<1, db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS>(i, 0);
-				auto intLine = src->intMat.block<1, db::data_entries::SDBR_NUM_DATA_ENTRIES_INTS>(i, 0);
+		const uint64_t* chunkValues(const db* src, const db::data_columns* cols,
+			const db::RowIdsType* within, size_t start, size_t n, int varnum, uint64_t* buf) {
+			// intMat is column-major, so it can be read in place like the column store.
+			const uint64_t* col = (cols) ? cols->intData(varnum)
+				: src->intMat.data() + (varnum * (size_t)src->intMat.rows());
+			if (!within) return col + start;
+			for (size_t i = 0; i < n; ++i) buf[i] = col[(*within)[start + i]];
+			return buf;
+		}
 
-				bool good = true;
-				for (int j = 0; j < db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j) {
-					if (!p->floatFilters[j].ranges.size()) continue;
-					if (!p->floatFilters[j].inRange(floatLine(j))) good = false;
-					if (!good) break;
+		/// Append the row numbers of the set bits in a chunk mask
+		void compactMask(const uint64_t* mask, size_t numWords,
+			const db::RowIdsType* within, size_t start, db::RowIdsType &out) {
+			for (size_t w = 0; w < numWords; ++w) {
+				uint64_t m = mask[w];
+				while (m) {
+					const size_t i = start + (w * 64) + ctz64(m);
+					out.push_back((within) ? (*within)[i] : (uint64_t)i);
+					m &= m - 1;
 				}
-				if (!good) continue;
-				for (int j = 0; j < db::data_entries::SDBR_NUM_DATA_ENTRIES_INTS; ++j) {
-					if (!p->intFilters[j].ranges.size()) continue;
-					if (!p->intFilters[j].inRange(intLine(j))) good = false;
-					if (!good) break;
+			}
+		}
+	}
+
+	size_t filterImpl::evalChunk(const db* src, const db::data_columns* cols,
+		const db::RowIdsType* within, size_t start, size_t n,
+		const compiledPredicates &preds, uint64_t* mask) const {
+		const size_t numWords = initMask(n, mask);
+		auto anySet = [&]() -> bool {
+			for (size_t w = 0; w < numWords; ++w) if (mask[w]) return true;
+			return false;
+		};
+
+		float fbuf[chunkRows];
+		uint64_t ibuf[chunkRows];
+		for (const auto &c : preds.floats) {
+			maskChunk(chunkValues(src, cols, within, start, n, c.varnum, fbuf), n, c.lo, c.hi, mask);
+			if (!anySet()) return 0;
+		}
+		for (const auto &c : preds.ints) {
+			maskChunk(chunkValues(src, cols, within, start, n, c.varnum, ibuf), n, c.lo, c.hi, mask);
+			if (!anySet()) return 0;
+		}
+		return numWords;
+	}
+
+	void filterImpl::selectChunk(const db* src, const db::data_columns* cols,
+		const db::RowIdsType* within, size_t start, size_t n,
+		const compiledPredicates &preds, db::RowIdsType &out) const {
+		uint64_t mask[chunkWords];
+		const size_t numWords = evalChunk(src, cols, within, start, n, preds, mask);
+		if (numWords) compactMask(mask, numWords, within, start, out);
+	}
+
+	bool filterImpl::planIndexed(const db* src, const db::RowIdsType* within,
+		const compiledPredicates &preds, db::RowIdsType &candidates) const {
+		const size_t numLines = (within) ? within->size() : (size_t)src->floatMat.rows();
+		// Index lookups return row sets in ascending order, so they can only
+		// be merged with a view whose rows are also ascending.
+		if (within && !std::is_sorted(within->begin(), within->end())) return false;
+		// Past this many matches, a sequential scan beats random row access.
+		const uint64_t maxMatches = (uint64_t)(numLines / 8);
+
+		struct plan {
+			const compiledPredicates::column<float>* pred;
+			std::shared_ptr<const db::data_index> index;
+			uint64_t count;
+		};
+		std::vector<plan> plans;
+		for (const auto &c : preds.floats) {
+			const auto col = (db::data_entries::data_entries_floats)c.varnum;
+			if (!db::isIndexed(col)) continue;
+			plan pl;
+			pl.pred = &c;
+			pl.index = src->getIndex(col);
+			pl.count = 0;
+			for (size_t r = 0; r < c.lo.size(); ++r)
+				pl.count += pl.index->count(c.lo[r], c.hi[r]);
+			plans.push_back(pl);
+		}
+		if (!plans.size()) return false;
+		std::sort(plans.begin(), plans.end(), [](const plan &a, const plan &b) {
+			return a.count < b.count; });
+		if (plans[0].count > maxMatches) return false;
+
+		auto findRows = [](const plan &pl, db::RowIdsType &res) {
+			res.clear();
+			for (size_t r = 0; r < pl.pred->lo.size(); ++r)
+				pl.index->find(pl.pred->lo[r], pl.pred->hi[r], res);
+			std::sort(res.begin(), res.end());
+			res.erase(std::unique(res.begin(), res.end()), res.end());
+		};
+		// Start from the most selective predicate and intersect with the others
+		// while they remain cheap. The remaining predicates are checked by the
+		// scan over the candidates.
+		findRows(plans[0], candidates);
+		db::RowIdsType other, merged;
+		for (size_t i = 1; i < plans.size() && candidates.size(); ++i) {
+			if (plans[i].count > maxMatches) break;
+			findRows(plans[i], other);
+			merged.clear();
+			std::set_intersection(candidates.begin(), candidates.end(),
+				other.begin(), other.end(), std::back_inserter(merged));
+			candidates.swap(merged);
+		}
+		if (within) {
+			merged.clear();
+			std::set_intersection(candidates.begin(), candidates.end(),
+				within->begin(), within->end(), std::back_inserter(merged));
+			candidates.swap(merged);
+		}
+		return true;
+	}
+
+	void filterImpl::selectParts(const db* src, const db::RowIdsType* within,
+		std::vector<db::RowIdsType> &parts) const {
+		size_t numLines = (within) ? within->size() : (size_t)src->floatMat.rows();
+		auto preds = compile();
+		db::RowIdsType candidates;
+		if (db::useIndexes() && planIndexed(src, within, *preds, candidates)) {
+			within = &candidates;
+			numLines = candidates.size();
+		}
+		std::shared_ptr<const db::data_columns> cols;
+		if (db::useColumnStore()) cols = src->getColumns();
+
+		const size_t numChunks = (numLines + chunkRows - 1) / chunkRows;
+		const size_t numWorkers = parallel::resolveThreads(numThreads, std::max<size_t>(numChunks, 1));
+		parts.assign(numWorkers, db::RowIdsType());
+		parallel::runWorkers(numWorkers, [&](size_t t) {
+			const size_t first = (numChunks * t) / numWorkers;
+			const size_t last = (numChunks * (t + 1)) / numWorkers;
+			for (size_t c = first; c < last; ++c) {
+				const size_t start = c * chunkRows;
+				const size_t n = std::min(chunkRows, numLines - start);
+				selectChunk(src, cols.get(), within, start, n, *preds, parts[t]);
+			}
+		});
+	}
+
+	uint64_t filterImpl::countRows(const db* src, const db::RowIdsType* within,
+		bool stopAtFirst) const {
+		size_t numLines = (within) ? within->size() : (size_t)src->floatMat.rows();
+		if (!numFilters()) return (uint64_t)numLines;
+		auto preds = compile();
+		db::RowIdsType candidates;
+		if (db::useIndexes() && planIndexed(src, within, *preds, candidates)) {
+			within = &candidates;
+			numLines = candidates.size();
+		}
+		std::shared_ptr<const db::data_columns> cols;
+		if (db::useColumnStore()) cols = src->getColumns();
+
+		// Each worker counts its own block of chunks. When only existence
+		// matters, every worker stops once any of them has found a row.
+		const size_t numChunks = (numLines + chunkRows - 1) / chunkRows;
+		const size_t numWorkers = parallel::resolveThreads(numThreads, std::max<size_t>(numChunks, 1));
+		std::vector<uint64_t> counts(numWorkers, 0);
+		std::atomic<bool> found(false);
+		parallel::runWorkers(numWorkers, [&](size_t t) {
+			uint64_t mask[chunkWords];
+			const size_t first = (numChunks * t) / numWorkers;
+			const size_t last = (numChunks * (t + 1)) / numWorkers;
+			for (size_t c = first; c < last; ++c) {
+				if (stopAtFirst && found.load(std::memory_order_relaxed)) return;
+				const size_t start = c * chunkRows;
+				const size_t n = std::min(chunkRows, numLines - start);
+				const size_t numWords = evalChunk(src, cols.get(), within, start, n, *preds, mask);
+				for (size_t w = 0; w < numWords; ++w)
+					counts[t] += (uint64_t)popcount64(mask[w]);
+				if (stopAtFirst && counts[t]) {
+					found = true;
+					return;
 				}
-				if (!good) continue;
+			}
+		});
+		uint64_t total = 0;
+		for (const auto &c : counts) total += c;
+		return total;
+	}
+
+	namespace {
+		/// Exclusive prefix sum of the part sizes. Part t starts at offsets[t]
+		/// in the combined output, and the final entry is the total size.
+		std::vector<size_t> partOffsets(const std::vector<db::RowIdsType> &parts) {
+			std::vector<size_t> offsets(parts.size() + 1, 0);
+			for (size_t t = 0; t < parts.size(); ++t)
+				offsets[t + 1] = offsets[t] + parts[t].size();
+			return offsets;
+		}
+	}
+
+	void filterImpl::selectRows(const db* src, const db::RowIdsType* within,
+		db::RowIdsType &out) const {
+		const size_t numLines = (within) ? within->size() : (size_t)src->floatMat.rows();
+		out.clear();
+
+		// Count number of filters. If zero, then can optimize.
+		if (!numFilters()) {
+			if (within) out = *within;
+			else {
+				out.resize(numLines);
+				for (size_t i = 0; i < numLines; ++i) out[i] = (uint64_t)i;
+			}
+			return;
+		}
+
+		std::vector<db::RowIdsType> parts;
+		selectParts(src, within, parts);
+		if (parts.size() == 1) {
+			out.swap(parts[0]);
+			return;
+		}
+		const auto offsets = partOffsets(parts);
+		out.resize(offsets.back());
+		parallel::runWorkers(parts.size(), [&](size_t t) {
+			std::copy(parts[t].begin(), parts[t].end(), out.begin() + offsets[t]);
+		});
+	}
+
+	void filterImpl::selectMany(const std::vector<const filterImpl*> &filters,
+		const db* src, const db::RowIdsType* within, std::vector<db::RowIdsType> &out) {
+		const size_t numLines = (within) ? within->size() : (size_t)src->floatMat.rows();
+		const size_t numFilters = filters.size();
 
-				res->floatMat.block<1, db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS>(totLines, 0) = floatLine;
-				res->intMat.block<1, db::data_entries::SDBR_NUM_DATA_ENTRIES_INTS>(totLines, 0) = intLine;
-				totLines++;
+		// Collect the distinct predicates, and record which ones each filter uses.
+		std::vector<std::shared_ptr<const compiledPredicates> > compiled(numFilters);
+		std::vector<const compiledPredicates::column<float>*> fpreds;
+		std::vector<const compiledPredicates::column<uint64_t>*> ipreds;
+		std::vector<std::vector<size_t> > fuses(numFilters), iuses(numFilters);
+		size_t numThreads = 1;
+		for (size_t k = 0; k < numFilters; ++k) {
+			compiled[k] = filters[k]->compile();
+			const size_t n = filters[k]->numThreads;
+			numThreads = (!n || !numThreads) ? 0 : std::max(numThreads, n);
+			for (const auto &c : compiled[k]->floats) {
+				size_t j = 0;
+				while (j < fpreds.size() && !(fpreds[j]->varnum == c.varnum
+					&& fpreds[j]->lo == c.lo && fpreds[j]->hi == c.hi)) ++j;
+				if (j == fpreds.size()) fpreds.push_back(&c);
+				fuses[k].push_back(j);
+			}
+			for (const auto &c : compiled[k]->ints) {
+				size_t j = 0;
+				while (j < ipreds.size() && !(ipreds[j]->varnum == c.varnum
+					&& ipreds[j]->lo == c.lo && ipreds[j]->hi == c.hi)) ++j;
+				if (j == ipreds.size()) ipreds.push_back(&c);
+				iuses[k].push_back(j);
 			}
-			res->floatMat.conservativeResize(totLines, src->floatMat.cols());
-			res->intMat.conservativeResize(totLines, src->intMat.cols());
 		}
-		else {
+		// Visit the predicates column by column, so that each column is
+		// gathered once per chunk.
+		std::vector<size_t> forder(fpreds.size()), iorder(ipreds.size());
+		for (size_t j = 0; j < forder.size(); ++j) forder[j] = j;
+		for (size_t j = 0; j < iorder.size(); ++j) iorder[j] = j;
+		std::stable_sort(forder.begin(), forder.end(), [&](size_t a, size_t b) {
+			return fpreds[a]->varnum < fpreds[b]->varnum; });
+		std::stable_sort(iorder.begin(), iorder.end(), [&](size_t a, size_t b) {
+			return ipreds[a]->varnum < ipreds[b]->varnum; });
+
+		std::shared_ptr<const db::data_columns> cols;
+		if (db::useColumnStore()) cols = src->getColumns();
+
+		const size_t numChunks = (numLines + chunkRows - 1) / chunkRows;
+		const size_t numWorkers = parallel::resolveThreads(numThreads, std::max<size_t>(numChunks, 1));
+		std::vector<std::vector<db::RowIdsType> > parts(numWorkers,
+			std::vector<db::RowIdsType>(numFilters));
+		parallel::runWorkers(numWorkers, [&](size_t t) {
+			std::vector<float> fbuf(chunkRows);
+			std::vector<uint64_t> ibuf(chunkRows);
+			std::vector<uint64_t> fmasks(fpreds.size() * chunkWords), imasks(ipreds.size() * chunkWords);
+			uint64_t mask[chunkWords];
+			const size_t first = (numChunks * t) / numWorkers;
+			const size_t last = (numChunks * (t + 1)) / numWorkers;
+			for (size_t ch = first; ch < last; ++ch) {
+				const size_t start = ch * chunkRows;
+				const size_t n = std::min(chunkRows, numLines - start);
+				const float* fvals = nullptr;
+				int lastVar = -1;
+				for (const auto j : forder) {
+					if (fpreds[j]->varnum != lastVar) {
+						lastVar = fpreds[j]->varnum;
+						fvals = chunkValues(src, cols.get(), within, start, n, lastVar, fbuf.data());
+					}
+					uint64_t* m = fmasks.data() + (j * chunkWords);
+					initMask(n, m);
+					maskChunk(fvals, n, fpreds[j]->lo, fpreds[j]->hi, m);
+				}
+				const uint64_t* ivals = nullptr;
+				lastVar = -1;
+				for (const auto j : iorder) {
+					if (ipreds[j]->varnum != lastVar) {
+						lastVar = ipreds[j]->varnum;
+						ivals = chunkValues(src, cols.get(), within, start, n, lastVar, ibuf.data());
+					}
+					uint64_t* m = imasks.data() + (j * chunkWords);
+					initMask(n, m);
+					maskChunk(ivals, n, ipreds[j]->lo, ipreds[j]->hi, m);
+				}
+				for (size_t k = 0; k < numFilters; ++k) {
+					const size_t numWords = initMask(n, mask);
+					for (const auto j : fuses[k])
+						for (size_t w = 0; w < numWords; ++w) mask[w] &= fmasks[(j * chunkWords) + w];
+					for (const auto j : iuses[k])
+						for (size_t w = 0; w < numWords; ++w) mask[w] &= imasks[(j * chunkWords) + w];
+					compactMask(mask, numWords, within, start, parts[t][k]);
+				}
+			}
+		});
+
+		out.assign(numFilters, db::RowIdsType());
+		for (size_t k = 0; k < numFilters; ++k) {
+			size_t total = 0;
+			for (size_t t = 0; t < numWorkers; ++t) total += parts[t][k].size();
+			out[k].reserve(total);
+			for (size_t t = 0; t < numWorkers; ++t)
+				out[k].insert(out[k].end(), parts[t][k].begin(), parts[t][k].end());
+		}
+	}
+
+	void filter::setThreads(size_t n) { p->numThreads = n; }
+	size_t filter::getThreads() const { return p->numThreads; }
+	void filter::setDefaultThreads(size_t n) { defaultThreads = n; }
+	size_t filter::getDefaultThreads() { return defaultThreads; }
+
+	void filter::compile() const { p->compile(); }
+
+	hash::HASH_p filter::queryHash() const {
+		auto preds = p->compile();
+		return hash::HASH_p(new hash::HASH_t(preds->hashLower, preds->hashUpper));
+	}
+
+	std::shared_ptr<const db> filter::apply(const db* src) const {
+		return queryCache::memoize<db>([&]() {
+			return queryCache::keyBuilder(queryCache::kinds::APPLY)
+				.add(src->serial).add(*queryHash());
+		}, [&]() { return applyUncached(src); });
+	}
+
+	std::shared_ptr<const db> filter::applyUncached(const db* src) const {
+		if (!p->numFilters()) {
+			std::shared_ptr<db> res(new db);
 			res->floatMat = src->floatMat;
 			res->intMat = src->intMat;
+			res->phaseMat = src->phaseMat;
+			return res;
 		}
-
+		std::vector<db::RowIdsType> parts;
+		p->selectParts(src, nullptr, parts);
+		// Each worker copies its own rows into a disjoint block of the output.
+		const auto offsets = partOffsets(parts);
+		std::shared_ptr<db> res(new db);
+		res->floatMat.resize((Eigen::Index)offsets.back(), db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS);
+		res->intMat.resize((Eigen::Index)offsets.back(), db::data_entries::SDBR_NUM_DATA_ENTRIES_INTS);
+		const bool hasPhase = src->phaseMat.rows() != 0;
+		if (hasPhase) res->phaseMat.resize((Eigen::Index)offsets.back(), src->phaseMat.cols());
+		parallel::runWorkers(parts.size(), [&](size_t t) {
+			for (size_t i = 0; i < parts[t].size(); ++i) {
+				const Eigen::Index o = (Eigen::Index)(offsets[t] + i);
+				const Eigen::Index r = (Eigen::Index)parts[t][i];
+				res->floatMat.block<1, db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS>(o, 0)
+					= src->floatMat.block<1, db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS>(r, 0);
+				res->intMat.block<1, db::data_entries::SDBR_NUM_DATA_ENTRIES_INTS>(o, 0)
+					= src->intMat.block<1, db::data_entries::SDBR_NUM_DATA_ENTRIES_INTS>(r, 0);
+				if (hasPhase) res->phaseMat.row(o) = src->phaseMat.row(r);
+			}
+		});
 		return res;
 	}
 	std::shared_ptr<const db> filter::apply(std::shared_ptr<const db> src) const {
 		return apply(src.get());
 	}
-}
 
+	std::shared_ptr<const db_view> filter::applyView(std::shared_ptr<const db> src) const {
+		std::shared_ptr<db_view> res(new db_view);
+		res->parent = src;
+		res->rows = queryCache::memoizeRows([&]() {
+			return queryCache::keyBuilder(queryCache::kinds::VIEW)
+				.add(src->serial).add((uint64_t)0).add((uint64_t)0).add(*queryHash());
+		}, [&](db::RowIdsType &rows) { p->selectRows(src.get(), nullptr, rows); });
+		return res;
+	}
+
+	std::shared_ptr<const db_view> filter::applyView(std::shared_ptr<const db_view> src) const {
+		// A view of a view is keyed by the rows that it starts from
+		std::shared_ptr<db_view> res(new db_view);
+		res->parent = src->parent;
+		res->rows = queryCache::memoizeRows([&]() {
+			return queryCache::keyBuilder(queryCache::kinds::VIEW)
+				.add(src->parent->serial).add(*(src->rowsHash())).add(*queryHash());
+		}, [&](db::RowIdsType &rows) { p->selectRows(src->parent.get(), &(src->rows), rows); });
+		return res;
+	}
+
+
+	uint64_t filter::count(const db* src) const {
+		return p->countRows(src, nullptr, false);
+	}
+	uint64_t filter::count(std::shared_ptr<const db> src) const {
+		return count(src.get());
+	}
+	uint64_t filter::count(std::shared_ptr<const db_view> src) const {
+		return p->countRows(src->parent.get(), &(src->rows), false);
+	}
+	bool filter::any(const db* src) const {
+		return p->countRows(src, nullptr, true) != 0;
+	}
+	bool filter::any(std::shared_ptr<const db> src) const {
+		return any(src.get());
+	}
+	bool filter::any(std::shared_ptr<const db_view> src) const {
+		return p->countRows(src->parent.get(), &(src->rows), true) != 0;
+	}
+
+	std::vector<const filterImpl*> filter::getImpls(
+		const std::vector<std::shared_ptr<const filter> > &filters) {
+		std::vector<const filterImpl*> res;
+		res.reserve(filters.size());
+		for (const auto &f : filters) {
+			if (!f) SDBR_throw(scatdb::error::error_types::xNullPointer)
+				.add<std::string>("Reason", "A filter passed to applyMany is NULL.");
+			res.push_back(f->p.get());
+		}
+		return res;
+	}
+
+	std::vector<db::RowIdsType> filter::applyManyRows(
+		const std::vector<std::shared_ptr<const filter> > &filters, const db* src) {
+		std::vector<db::RowIdsType> res;
+		filterImpl::selectMany(getImpls(filters), src, nullptr, res);
+		return res;
+	}
+
+	std::vector<std::shared_ptr<const db_view> > filter::applyMany(
+		const std::vector<std::shared_ptr<const filter> > &filters, std::shared_ptr<const db> src) {
+		std::vector<db::RowIdsType> rows;
+		filterImpl::selectMany(getImpls(filters), src.get(), nullptr, rows);
+		std::vector<std::shared_ptr<const db_view> > res;
+		res.reserve(rows.size());
+		for (auto &r : rows) {
+			std::shared_ptr<db_view> v(new db_view);
+			v->parent = src;
+			v->rows.swap(r);
+			res.push_back(v);
+		}
+		return res;
+	}
+
+	std::vector<std::shared_ptr<const db_view> > filter::applyMany(
+		const std::vector<std::shared_ptr<const filter> > &filters, std::shared_ptr<const db_view> src) {
+		std::vector<db::RowIdsType> rows;
+		filterImpl::selectMany(getImpls(filters), src->parent.get(), &(src->rows), rows);
+		std::vector<std::shared_ptr<const db_view> > res;
+		res.reserve(rows.size());
+		for (auto &r : rows) {
+			std::shared_ptr<db_view> v(new db_view);
+			v->parent = src->parent;
+			v->rows.swap(r);
+			res.push_back(v);
+		}
+		return res;
+	}
+}
@@ -1,8 +1,26 @@
 #include "../scatdb/defs.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <list>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <string>
 #include <sstream>
+#include <vector>
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
 #include <boost/spirit/include/qi.hpp>
 #include <boost/spirit/include/phoenix_core.hpp>
 #include <boost/spirit/include/phoenix_operator.hpp>
@@ -14,6 +32,7 @@
 #include "../private/info.hpp"
 #include "../scatdb/error.hpp"
 #include "../scatdb/logging.hpp"
+#include "../private/parallel.hpp"
 
 #include "../scatdb/scatdb.hpp"
 
@@ -26,8 +45,226 @@ namespace {
 	/// Always points to the first loaded database file.
 	std::shared_ptr<const scatdb::db> loadedDB;
 	std::mutex m_db;
+	/// The HDF5 library is not built thread-safe everywhere, so HDF5 reads are serialized.
+	std::mutex m_hdf5;
+
+	/// Identifies one loaded database. A file that is rewritten gets a new
+	/// modification time, size or file id, and so a new entry.
+	struct loadKey {
+		std::string path;
+		/// Modification time, in the finest units the platform reports
+		/// (ns since the epoch on POSIX, 100 ns ticks on Windows)
+		uint64_t mtime;
+		uintmax_t size;
+		/// Inode number on POSIX, so that a file replaced by rename is
+		/// caught even within one timestamp tick. Zero on Windows.
+		uint64_t fileId;
+		std::string hdfinternalpath;
+		uint64_t floatColumns, firstRow, numRows;
+		bool operator<(const loadKey &rhs) const {
+			if (path != rhs.path) return path < rhs.path;
+			if (mtime != rhs.mtime) return mtime < rhs.mtime;
+			if (size != rhs.size) return size < rhs.size;
+			if (fileId != rhs.fileId) return fileId < rhs.fileId;
+			if (hdfinternalpath != rhs.hdfinternalpath) return hdfinternalpath < rhs.hdfinternalpath;
+			if (floatColumns != rhs.floatColumns) return floatColumns < rhs.floatColumns;
+			if (firstRow != rhs.firstRow) return firstRow < rhs.firstRow;
+			return numRows < rhs.numRows;
+		}
+	};
+	/// Fill in the modification time and file id of a key. Whole-second
+	/// times would miss a file rewritten at the same size within a second.
+	void statKey(const std::string &path, loadKey &key) {
+		key.mtime = 0;
+		key.fileId = 0;
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA info;
+		if (GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &info))
+			key.mtime = ((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32)
+				| (uint64_t)info.ftLastWriteTime.dwLowDateTime;
+#else
+		struct stat st;
+		if (stat(path.c_str(), &st)) return;
+#if defined(__APPLE__)
+		const struct timespec &ts = st.st_mtimespec;
+#else
+		const struct timespec &ts = st.st_mtim;
+#endif
+		key.mtime = ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+		key.fileId = (uint64_t)st.st_ino;
+#endif
+	}
+
+	/// Every database loaded by file, for as long as someone holds it.
+	/// Guarded by m_db.
+	std::map<loadKey, std::weak_ptr<const scatdb::db> > loadCache;
+	/// The most recently used databases, newest first, held until their
+	/// total size exceeds the budget. Guarded by m_db.
+	std::list<std::pair<loadKey, std::shared_ptr<const scatdb::db> > > recentDBs;
+	uint64_t recentBytes = 0;
+	uint64_t loadCacheBudget = 0;
+	/// Databases that are held regardless of the budget. Guarded by m_db.
+	std::set<std::shared_ptr<const scatdb::db> > pinnedDBs;
+
+	uint64_t dbBytes(const scatdb::db &d) {
+		return (uint64_t)((d.floatMat.size() * sizeof(float)) + (d.intMat.size() * sizeof(uint64_t)));
+	}
+
+	/// Drop the oldest strong references until the rest fit in the budget.
+	/// Expects m_db to be held.
+	void trimRecent() {
+		while (recentDBs.size() && recentBytes > loadCacheBudget) {
+			recentBytes -= dbBytes(*(recentDBs.back().second));
+			recentDBs.pop_back();
+		}
+	}
+
+	/// Move (or add) a database to the front of the recently used list.
+	/// Expects m_db to be held.
+	void touchRecent(const loadKey &key, const std::shared_ptr<const scatdb::db> &d) {
+		for (auto it = recentDBs.begin(); it != recentDBs.end(); ++it) {
+			if (it->second != d) continue;
+			recentDBs.splice(recentDBs.begin(), recentDBs, it);
+			return;
+		}
+		if (!loadCacheBudget) return;
+		recentDBs.push_front(std::make_pair(key, d));
+		recentBytes += dbBytes(*d);
+		trimRecent();
+	}
 	bool finddberrgiven = false;
 	std::string lastFoundDBfile;
+
+	/// Text files are split into chunks of at least this many bytes, one per thread
+	const size_t minChunkBytes = 1 << 19;
+
+	inline int popcount32(uint32_t v) {
+#if defined(_MSC_VER)
+		return (int)__popcnt(v);
+#else
+		return __builtin_popcount(v);
+#endif
+	}
+
+	/// Count the newlines in [p, end)
+	size_t countLines(const char* p, const char* end) {
+		size_t n = 0;
+#if defined(__AVX2__)
+		const __m256i nl = _mm256_set1_epi8('\n');
+		for (; p + 32 <= end; p += 32) {
+			const __m256i x = _mm256_loadu_si256((const __m256i*)p);
+			n += (size_t)popcount32((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, nl)));
+		}
+#elif defined(__SSE2__) || defined(_M_X64)
+		const __m128i nl = _mm_set1_epi8('\n');
+		for (; p + 16 <= end; p += 16) {
+			const __m128i x = _mm_loadu_si128((const __m128i*)p);
+			n += (size_t)popcount32((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, nl)));
+		}
+#endif
+		for (; p < end; ++p)
+			n += (size_t)(*p == '\n');
+		return n;
+	}
+
+	/// Find the start of the line after p, or end.
+	const char* nextLine(const char* p, const char* end) {
+		while (p < end && *p != '\n') ++p;
+		return (p < end) ? p + 1 : end;
+	}
+
+	/// Parse an unsigned integer field in [p, end). Anything unexpected is
+	/// handed to spirit, as before.
+	uint64_t parseInt(const char* p, const char* end) {
+		const char* q = p;
+		uint64_t v = 0;
+		while (q < end && (unsigned)(*q - '0') < 10) v = (v * 10) + (uint64_t)(*q++ - '0');
+		if (q == p || (q < end && *q != '\r' && *q != ' ')) {
+			v = 0;
+			boost::spirit::qi::parse(p, end, boost::spirit::qi::int_, v);
+		}
+		return v;
+	}
+
+	/// Parse a decimal float field in [p, end), as written by printf's %f and
+	/// %e. When the digits fit in 53 bits and the power of ten is at most
+	/// 1e22, both are exact doubles, so a single multiply or divide rounds
+	/// correctly. Rounding that double to float is then also correct, since a
+	/// double carries more than twice a float's precision. Anything else
+	/// (nan, inf, long mantissas, large exponents) goes to strtof.
+	float parseFloat(const char* p, const char* end) {
+		static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+			1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		const char* q = p;
+		bool neg = false;
+		if (q < end && (*q == '-' || *q == '+')) neg = (*q++ == '-');
+		uint64_t mant = 0;
+		int digits = 0, exp10 = 0;
+		for (; q < end && (unsigned)(*q - '0') < 10; ++q, ++digits)
+			mant = (mant * 10) + (uint64_t)(*q - '0');
+		if (q < end && *q == '.') {
+			for (++q; q < end && (unsigned)(*q - '0') < 10; ++q, ++digits, --exp10)
+				mant = (mant * 10) + (uint64_t)(*q - '0');
+		}
+		bool ok = (digits > 0) && (digits <= 19) && (mant <= (1ULL << 53));
+		if (ok && q < end && (*q == 'e' || *q == 'E')) {
+			++q;
+			bool eneg = false;
+			if (q < end && (*q == '-' || *q == '+')) eneg = (*q++ == '-');
+			int e = 0, edigits = 0;
+			for (; q < end && (unsigned)(*q - '0') < 10 && e < 10000; ++q, ++edigits)
+				e = (e * 10) + (*q - '0');
+			ok = (edigits > 0);
+			exp10 += (eneg) ? -e : e;
+		}
+		if (q < end && *q != '\r' && *q != ' ') ok = false;
+		if (ok && exp10 >= -22 && exp10 <= 22) {
+			const double v = (exp10 < 0) ? (double)mant / pow10[-exp10]
+				: (double)mant * pow10[exp10];
+			return (float)((neg) ? -v : v);
+		}
+		// The field is not null-terminated, so strtof gets a copy
+		char buf[64];
+		std::string longField;
+		const char* field = buf;
+		const size_t len = (size_t)(end - p);
+		if (len < sizeof(buf)) {
+			std::memcpy(buf, p, len);
+			buf[len] = 0;
+		} else {
+			longField.assign(p, end);
+			field = longField.c_str();
+		}
+		char* fend = nullptr;
+		const float v = std::strtof(field, &fend);
+		return (fend == field) ? std::numeric_limits<float>::quiet_NaN() : v;
+	}
+
+	/// Parse the lines in [p, end) into consecutive rows, starting at row
+	/// firstRow. Missing fields are left as NaN, and extra fields are ignored.
+	void parseLines(const char* p, const char* end, size_t firstRow, size_t numRows,
+		uint64_t* ints, float* floats) {
+		using scatdb::db;
+		const size_t numFloatCols = db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS;
+		for (size_t row = firstRow; row < firstRow + numRows && p < end; ++row) {
+			const char* eol = p;
+			while (eol < end && *eol != '\n') ++eol;
+			float* out = floats + (row * numFloatCols);
+			// The Eigen float matrix is row-major, so each line fills a contiguous block
+			for (size_t j = 0; j < numFloatCols; ++j)
+				out[j] = std::numeric_limits<float>::quiet_NaN();
+			int col = 0;
+			while (p <= eol) {
+				const char* fEnd = p;
+				while (fEnd < eol && *fEnd != ',') ++fEnd;
+				if (col == 0) ints[row] = parseInt(p, fEnd);
+				else if (col <= (int)numFloatCols) out[col - 1] = parseFloat(p, fEnd);
+				++col;
+				p = fEnd + 1;
+			}
+			p = eol + 1;
+		}
+	}
 }
 
 namespace scatdb {
@@ -200,7 +437,6 @@ namespace scatdb {
 	void db::readDBtext(std::shared_ptr<db> res, const char* dbf) {
 
 		using namespace boost::interprocess;
-		//const std::size_t FileSize = 10000;
 		file_mapping m_file(dbf, read_only);
 		mapped_region region(m_file, read_only);
 		void * addr = region.get_address();
@@ -208,73 +444,91 @@ namespace scatdb {
 		std::size_t size = region.get_size();
 		const char *left = caddr, *right = caddr + size;
 		// Skip header line
-		while ((left[0] != '\n') && left < right) left++;
-		left++;
-		//std::memset(addr, 1, size);
-		// Count number of lines
-		// std::count_if is slow
-		//size_t numLines = (size_t)std::count_if(caddr, caddr + size, [](const char a) {return (a == '\n') ? true : false; });
-		size_t numLines = 0;
-		for (const char* cleft = left; cleft < right; ++cleft) {
-			if (cleft[0] == '\n') numLines++;
+		left = nextLine(left, right);
+
+		// Split the data into chunks that end on line boundaries. Each chunk
+		// is counted and then parsed on its own thread.
+		const size_t numChunks = parallel::resolveThreads(0,
+			(size_t)(right - left) / minChunkBytes);
+		std::vector<const char*> bounds(numChunks + 1, right);
+		bounds[0] = left;
+		for (size_t c = 1; c < numChunks; ++c) {
+			const char* target = left + (((size_t)(right - left) * c) / numChunks);
+			bounds[c] = nextLine(std::max(target, bounds[c - 1]), right);
 		}
-		//std::vector<int> ints;
-		//std::vector<float> floats;
-		const size_t numInts = numLines * data_entries::SDBR_NUM_DATA_ENTRIES_INTS;
-		const size_t numFloats = numLines * data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS;
+		std::vector<size_t> chunkLines(numChunks + 1, 0);
+		parallel::runWorkers(numChunks, [&](size_t c) {
+			chunkLines[c + 1] = countLines(bounds[c], bounds[c + 1]);
+		});
+		// A last line without a trailing newline still counts
+		if (right > left && right[-1] != '\n') chunkLines[numChunks]++;
+		for (size_t c = 0; c < numChunks; ++c)
+			chunkLines[c + 1] += chunkLines[c];
+		const size_t numLines = chunkLines[numChunks];
+
 		res->floatMat.resize(numLines, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS);
 		res->intMat.resize(numLines, data_entries::SDBR_NUM_DATA_ENTRIES_INTS);
-		//ints.resize(numInts);
-		//floats.resize(numFloats);
 		uint64_t* ints = res->intMat.data();
 		float* floats = res->floatMat.data();
-		size_t line = 0;
-		int col = 0;
-		const size_t numDelims = 2;
-		const char delims[numDelims] = { ',', '\n' };
-		bool lineEnd = true;
-		long curInt = 0, curFloat = 0;
-		
-		while (left < right) {
-			// Skip non-digits
-			// std::find_first_of is _very_ slow on windows.
-			//const char* pEnd = std::find_first_of(delims, delims + numDelims, left, right);
-			const char *pEnd = left;
-			while ((pEnd[0] != '\n') && (pEnd[0] != ',') && pEnd < right) pEnd++;
-
-			if (pEnd > right) pEnd = right;
-			col = (lineEnd) ? 0 : col + 1;
-			lineEnd = (pEnd[0] == '\n') ? true : false;
-			using boost::spirit::qi::float_;
-			using boost::spirit::qi::int_;
-			using boost::spirit::qi::parse;
-			// The Eigen matrices are stored in column-major format
-			//using namespace scatdb::macros;
-			switch (col) {
-			case 0: // flaketype
-				assert(numInts > curInt);
-				parse(left, pEnd, int_, ints[curInt]);
-				//ints[curInt] = m_atoi<int>(left, pEnd - left);
-				++curInt;
-				break;
-			default: // All other columns
-				assert(numFloats > curFloat);
-				parse(left, pEnd, float_, floats[curFloat]);
-				//floats[curFloat] = m_atof<float>(left, pEnd - left);
-				++curFloat;
-				break;
-			}
-
-			left = pEnd + 1;
-		}
+		parallel::runWorkers(numChunks, [&](size_t c) {
+			parseLines(bounds[c], bounds[c + 1], chunkLines[c],
+				chunkLines[c + 1] - chunkLines[c], ints, floats);
+		});
 		SDBR_log("scatdb", scatdb::logging::DEBUG_2,
 			"Overall database has "
 			<< numLines << " lines of data that were successfully read.");
 	}
 
+	namespace {
+		const uint64_t allFloatColumns = (1ULL << db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS) - 1;
+
+		/// Trim a fully-read database to the rows and columns in opts
+		void project(std::shared_ptr<db> &res, const db::load_options &opts) {
+			const uint64_t rows = (uint64_t)res->floatMat.rows();
+			const uint64_t first = (opts.firstRow < rows) ? opts.firstRow : rows;
+			const uint64_t n = (opts.numRows < rows - first) ? opts.numRows : rows - first;
+			if (first || n != rows) {
+				res->floatMat = res->floatMat.middleRows((Eigen::Index)first, (Eigen::Index)n).eval();
+				res->intMat = res->intMat.middleRows((Eigen::Index)first, (Eigen::Index)n).eval();
+				if (res->phaseMat.rows())
+					res->phaseMat = res->phaseMat.middleRows((Eigen::Index)first, (Eigen::Index)n).eval();
+			}
+			for (int j = 0; j < db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j)
+				if (!((opts.floatColumns >> j) & 1))
+					res->floatMat.col(j).setConstant(std::numeric_limits<float>::quiet_NaN());
+		}
+	}
+
+	db::load_options::load_options() : floatColumns(allFloatColumns), firstRow(0), numRows(~0ULL) {}
+	db::load_options::load_options(uint64_t floatColumns, uint64_t firstRow, uint64_t numRows)
+		: floatColumns(floatColumns & allFloatColumns), firstRow(firstRow), numRows(numRows) {}
+	bool db::load_options::readsAll() const {
+		return (floatColumns == allFloatColumns) && !firstRow && (numRows == ~0ULL);
+	}
+
+	uint64_t db::loadedColumns() const { return srcOptions.floatColumns; }
+
+	std::shared_ptr<const db> db::loadColumns(std::shared_ptr<const db> src, uint64_t floatColumns) {
+		if (!src) SDBR_throw(scatdb::error::error_types::xNullPointer)
+			.add<std::string>("Reason", "The source database is NULL.");
+		floatColumns &= allFloatColumns;
+		if (!(floatColumns & ~src->loadedColumns())) return src;
+		if (!src->srcFile.size()) SDBR_throw(scatdb::error::error_types::xBadInput)
+			.add<std::string>("Reason", "Database was not loaded from a file, so its missing columns cannot be read.");
+		load_options opts = src->srcOptions;
+		opts.floatColumns |= floatColumns;
+		return loadDB(src->srcFile.c_str(),
+			(src->srcGroup.size()) ? src->srcGroup.c_str() : nullptr, opts);
+	}
+
 	std::shared_ptr<const db> db::loadDB(const char* dbfile, const char* hdfinternalpath) {
-		std::lock_guard<std::mutex> lock(m_db);
-		if (!dbfile && loadedDB) return loadedDB;
+		return loadDB(dbfile, hdfinternalpath, load_options());
+	}
+
+	std::shared_ptr<const db> db::loadDB(const char* dbfile, const char* hdfinternalpath,
+		const load_options &opts) {
+		std::unique_lock<std::mutex> lock(m_db);
+		if (!dbfile && loadedDB && opts.readsAll()) return loadedDB;
 
 		// Load the database
 		SDBR_log("scatdb", scatdb::logging::DEBUG_2,
@@ -311,20 +565,100 @@ namespace scatdb {
 		}
 
 		// From this point, it is established that the scattering database does exist.
+		// Reuse it if the same file (and HDF5 group) is still loaded.
+		const std::string ext = p.extension().string();
+		loadKey key;
+		key.path = canonical(p).string();
+		statKey(key.path, key);
+		key.size = file_size(p);
+		if (ext == ".hdf5" && hdfinternalpath) key.hdfinternalpath = std::string(hdfinternalpath);
+		key.floatColumns = opts.floatColumns;
+		key.firstRow = opts.firstRow;
+		key.numRows = opts.numRows;
+		auto cached = loadCache.find(key);
+		if (cached != loadCache.end()) {
+			std::shared_ptr<const db> hit = cached->second.lock();
+			if (hit) {
+				SDBR_log("scatdb", scatdb::logging::DEBUG_2,
+					"Database is already loaded: " << key.path);
+				touchRecent(key, hit);
+				if (!loadedDB && opts.readsAll()) loadedDB = hit;
+				return hit;
+			}
+			loadCache.erase(cached);
+		}
+
+		// Different files load in parallel, so the lock is released while reading.
+		lock.unlock();
 		std::shared_ptr<db> newdb(new db);
-		if (p.extension().string() == ".csv") readDBtext(newdb, dbf.c_str());
-		else if (p.extension().string() == ".hdf5") readDBhdf5(newdb, dbf.c_str());
-		else if (p.extension().string() == ".dda") readDBscatdb(newdb, dbf.c_str());
+		if (ext == ".csv") readDBtext(newdb, dbf.c_str());
+		else if (ext == ".hdf5") {
+			std::lock_guard<std::mutex> hlock(m_hdf5);
+			readDBhdf5(newdb, dbf.c_str(), hdfinternalpath, opts);
+		}
+		else if (ext == ".dda") readDBscatdb(newdb, dbf.c_str());
+		else if (ext == ".sdbbin") readDBbinary(newdb, dbf.c_str());
 		else SDBR_throw(scatdb::error::error_types::xUnknownFileFormat)
 			.add<std::string>("filename", p.string());
+		if (ext != ".hdf5" && !opts.readsAll()) {
+			project(newdb, opts);
+			// The mapped columns of a binary file no longer match
+			newdb->pColumns.reset();
+		}
+		newdb->srcFile = dbf;
+		if (key.hdfinternalpath.size()) newdb->srcGroup = key.hdfinternalpath;
+		newdb->srcOptions = opts;
+		if (useColumnStore()) newdb->getColumns();
+		lock.lock();
+
+		// If another thread loaded the same file in the meantime, keep its copy
+		// so that every caller shares one instance.
+		std::shared_ptr<const db> res = newdb;
+		std::shared_ptr<const db> other = loadCache[key].lock();
+		if (other) res = other;
+		else loadCache[key] = res;
+		touchRecent(key, res);
 
 		// The usual case is that the database is loaded once. If so, store a copy for
 		// subsequent function calls.
-		if (!loadedDB) loadedDB = newdb;
+		if (!loadedDB && opts.readsAll()) loadedDB = res;
 
 		SDBR_log("scatdb", scatdb::logging::DEBUG_2, 
 			"Database loaded successfully.");
-		return newdb;
+		return res;
+	}
+
+	void db::setLoadCacheBudget(uint64_t bytes) {
+		std::lock_guard<std::mutex> lock(m_db);
+		loadCacheBudget = bytes;
+		trimRecent();
+	}
+
+	uint64_t db::getLoadCacheBudget() {
+		std::lock_guard<std::mutex> lock(m_db);
+		return loadCacheBudget;
+	}
+
+	void db::pin(std::shared_ptr<const db> d) {
+		if (!d) return;
+		std::lock_guard<std::mutex> lock(m_db);
+		pinnedDBs.insert(d);
+	}
+
+	void db::unpin(std::shared_ptr<const db> d) {
+		std::lock_guard<std::mutex> lock(m_db);
+		pinnedDBs.erase(d);
+	}
+
+	void db::clearLoadCache() {
+		std::lock_guard<std::mutex> lock(m_db);
+		recentDBs.clear();
+		recentBytes = 0;
+		pinnedDBs.clear();
+		for (auto it = loadCache.begin(); it != loadCache.end();) {
+			if (it->second.expired()) it = loadCache.erase(it);
+			else ++it;
+		}
 	}
 }
 
@@ -0,0 +1,220 @@
+#include "../scatdb/defs.hpp"
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "../scatdb/error.hpp"
+#include "../scatdb/hash.hpp"
+#include "../scatdb/logging.hpp"
+#include "../scatdb/scatdb.hpp"
+
+namespace {
+	const char binaryMagic[8] = { 'S', 'D', 'B', 'R', 'B', 'I', 'N', 0 };
+	const uint32_t binaryVersion = 2;
+	/// Written in native byte order. A file from a machine with the other
+	/// byte order reads this back as 0x04030201.
+	const uint32_t byteOrderMark = 0x01020304;
+
+	std::atomic<bool> verifyChecksums(false);
+
+	/// Fixed header at the start of a .sdbbin file. It is followed, starting
+	/// at dataOffset, by the data region:
+	/// - each float column (floatColBytes apiece)
+	/// - each int column (intColBytes apiece)
+	/// Every block starts on an alignment boundary, and the checksum covers
+	/// the whole data region.
+	struct binaryHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		uint32_t numFloatCols;
+		uint32_t numIntCols;
+		uint64_t rows;
+		uint64_t alignment;
+		uint64_t dataOffset;
+		uint64_t floatColBytes;
+		uint64_t intColBytes;
+		uint64_t dataBytes;
+		uint64_t checksumLower;
+		uint64_t checksumUpper;
+	};
+
+	/// Round a byte count up to the next multiple of the column alignment
+	uint64_t padBytes(uint64_t bytes) {
+		const uint64_t a = scatdb::db::data_columns::alignment;
+		return ((bytes + a - 1) / a) * a;
+	}
+
+	/// Fill in the block sizes for a table with the given number of rows
+	binaryHeader makeHeader(uint64_t rows) {
+		using scatdb::db;
+		binaryHeader h;
+		std::memset(&h, 0, sizeof(h));
+		std::memcpy(h.magic, binaryMagic, sizeof(binaryMagic));
+		h.version = binaryVersion;
+		h.byteOrder = byteOrderMark;
+		h.numFloatCols = db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS;
+		h.numIntCols = db::data_entries::SDBR_NUM_DATA_ENTRIES_INTS;
+		h.rows = rows;
+		h.alignment = db::data_columns::alignment;
+		h.dataOffset = padBytes(sizeof(binaryHeader));
+		h.floatColBytes = padBytes(rows * sizeof(float));
+		h.intColBytes = padBytes(rows * sizeof(uint64_t));
+		h.dataBytes = (h.floatColBytes * h.numFloatCols)
+			+ (h.intColBytes * h.numIntCols);
+		return h;
+	}
+
+	/// MurmurHash3 of the data region. Large regions are hashed in pieces,
+	/// and the piece hashes are then hashed together.
+	scatdb::hash::HASH_t checksum(const char* p, uint64_t n) {
+		using namespace scatdb::hash;
+		const uint64_t pieceBytes = 1ULL << 30;
+		if (n <= pieceBytes) return *(HASH(p, (int)n));
+		std::vector<HASH_t> pieces;
+		for (uint64_t off = 0; off < n; off += pieceBytes) {
+			const uint64_t len = (n - off < pieceBytes) ? n - off : pieceBytes;
+			pieces.push_back(*(HASH(p + off, (int)len)));
+		}
+		return *(HASH(pieces.data(), (int)(pieces.size() * sizeof(HASH_t))));
+	}
+}
+
+namespace scatdb {
+	void db::writeBinaryFile(const char* filename) const {
+		if (!filename)
+			SDBR_throw(scatdb::error::error_types::xNullPointer)
+			.add<std::string>("Reason", "The variable 'filename' was NULL.");
+		const uint64_t rows = (uint64_t)floatMat.rows();
+		binaryHeader h = makeHeader(rows);
+
+		// The file is assembled in memory, so that the checksum can be
+		// placed in the header before anything is written.
+		std::vector<char> data((size_t)h.dataBytes, 0);
+		char* base = data.data();
+		for (int j = 0; j < data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j) {
+			float* col = reinterpret_cast<float*>(base);
+			for (uint64_t i = 0; i < rows; ++i)
+				col[i] = floatMat((Eigen::Index)i, j);
+			base += h.floatColBytes;
+		}
+		for (int j = 0; j < data_entries::SDBR_NUM_DATA_ENTRIES_INTS; ++j) {
+			if (rows) std::memcpy(base, intMat.data() + (j * rows), (size_t)(rows * sizeof(uint64_t)));
+			base += h.intColBytes;
+		}
+		const hash::HASH_t sum = checksum(data.data(), h.dataBytes);
+		h.checksumLower = sum.lower;
+		h.checksumUpper = sum.upper;
+
+		std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+		if (!out)
+			SDBR_throw(scatdb::error::error_types::xBadFunctionReturn)
+			.add<std::string>("Reason", "Cannot open the output file.")
+			.add<std::string>("filename", std::string(filename));
+		std::vector<char> head((size_t)h.dataOffset, 0);
+		std::memcpy(head.data(), &h, sizeof(h));
+		out.write(head.data(), (std::streamsize)head.size());
+		out.write(data.data(), (std::streamsize)data.size());
+		if (!out)
+			SDBR_throw(scatdb::error::error_types::xBadFunctionReturn)
+			.add<std::string>("Reason", "Writing the output file failed.")
+			.add<std::string>("filename", std::string(filename));
+	}
+
+	void db_view::writeBinaryFile(const char* filename) const {
+		materialize()->writeBinaryFile(filename);
+	}
+
+	void db::readDBbinary(std::shared_ptr<db> res, const char* dbfile) {
+		if (!dbfile) SDBR_throw(scatdb::error::error_types::xBadInput)
+			.add<std::string>("Reason", "dbfile is null");
+		using namespace boost::interprocess;
+		file_mapping m_file(dbfile, read_only);
+		std::shared_ptr<mapped_region> region(new mapped_region(m_file, read_only));
+		const char* caddr = (const char*)region->get_address();
+		const uint64_t size = (uint64_t)region->get_size();
+
+		binaryHeader h;
+		if (size < sizeof(h))
+			SDBR_throw(scatdb::error::error_types::xUnknownFileFormat)
+			.add<std::string>("Reason", "File is too small to hold a header.")
+			.add<std::string>("filename", std::string(dbfile));
+		std::memcpy(&h, caddr, sizeof(h));
+		if (std::memcmp(h.magic, binaryMagic, sizeof(binaryMagic)))
+			SDBR_throw(scatdb::error::error_types::xUnknownFileFormat)
+			.add<std::string>("Reason", "File is not a binary scattering database.")
+			.add<std::string>("filename", std::string(dbfile));
+		if (h.byteOrder != byteOrderMark)
+			SDBR_throw(scatdb::error::error_types::xBadInput)
+			.add<std::string>("Reason", "File was written on a machine with a different byte order.")
+			.add<std::string>("filename", std::string(dbfile));
+		if (h.version != binaryVersion)
+			SDBR_throw(scatdb::error::error_types::xBadInput)
+			.add<std::string>("Reason", "Unsupported binary database version.")
+			.add<uint64_t>("version", (uint64_t)h.version)
+			.add<std::string>("filename", std::string(dbfile));
+		// Everything but the checksum is determined by the row count
+		binaryHeader expected = makeHeader(h.rows);
+		expected.checksumLower = h.checksumLower;
+		expected.checksumUpper = h.checksumUpper;
+		if (std::memcmp(&h, &expected, sizeof(h)) || (size < h.dataOffset + h.dataBytes))
+			SDBR_throw(scatdb::error::error_types::xBadInput)
+			.add<std::string>("Reason", "Binary database header is inconsistent or the file is truncated.")
+			.add<uint64_t>("rows", h.rows)
+			.add<uint64_t>("fileSize", size)
+			.add<std::string>("filename", std::string(dbfile));
+		const char* data = caddr + h.dataOffset;
+		if (verifyBinaryChecksums()) {
+			const hash::HASH_t sum = checksum(data, h.dataBytes);
+			if (sum.lower != h.checksumLower || sum.upper != h.checksumUpper)
+				SDBR_throw(scatdb::error::error_types::xBadInput)
+				.add<std::string>("Reason", "Binary database checksum does not match.")
+				.add<std::string>("filename", std::string(dbfile));
+		}
+
+		// The column store points straight into the mapping, which stays open
+		// for as long as the columns are in use.
+		std::shared_ptr<data_columns> cols(new data_columns);
+		cols->rows = h.rows;
+		cols->backing = std::shared_ptr<char>((char*)caddr, [region](char*) {});
+		const char* base = data;
+		for (int j = 0; j < data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j) {
+			cols->floatPtrs[j] = reinterpret_cast<const float*>(base);
+			base += h.floatColBytes;
+		}
+		for (int j = 0; j < data_entries::SDBR_NUM_DATA_ENTRIES_INTS; ++j) {
+			cols->intPtrs[j] = reinterpret_cast<const uint64_t*>(base);
+			base += h.intColBytes;
+		}
+
+		// floatMat and intMat are owning Eigen matrices, so they are filled
+		// from the mapped columns. floatMat is row-major, and is transposed
+		// in row blocks so that each pass stays in cache.
+		const Eigen::Index rows = (Eigen::Index)h.rows;
+		res->floatMat.resize(rows, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS);
+		res->intMat.resize(rows, data_entries::SDBR_NUM_DATA_ENTRIES_INTS);
+		const Eigen::Index blockRows = 4096;
+		for (Eigen::Index i0 = 0; i0 < rows; i0 += blockRows) {
+			const Eigen::Index i1 = (rows - i0 < blockRows) ? rows : i0 + blockRows;
+			for (int j = 0; j < data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j) {
+				const float* col = cols->floatPtrs[j];
+				for (Eigen::Index i = i0; i < i1; ++i)
+					res->floatMat(i, j) = col[i];
+			}
+		}
+		for (int j = 0; j < data_entries::SDBR_NUM_DATA_ENTRIES_INTS; ++j)
+			if (rows) std::memcpy(res->intMat.data() + (j * rows), cols->intPtrs[j],
+				(size_t)(h.rows * sizeof(uint64_t)));
+		res->pColumns = cols;
+		SDBR_log("scatdb", scatdb::logging::DEBUG_2,
+			"Binary database has " << h.rows << " rows.");
+	}
+
+	void db::verifyBinaryChecksums(bool val) { verifyChecksums = val; }
+	bool db::verifyBinaryChecksums() { return verifyChecksums; }
+}
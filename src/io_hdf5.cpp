@@ -1,4 +1,5 @@
 #include "../scatdb/defs.hpp"
+#include <limits>
 #include <memory>
 #include <set>
 #include <string>
@@ -14,6 +15,11 @@ namespace scatdb {
 
 	void db::readDBhdf5(std::shared_ptr<db> res,
 		const char* dbfile, const char* hdfinternalpath) {
+		readDBhdf5(res, dbfile, hdfinternalpath, load_options());
+	}
+
+	void db::readDBhdf5(std::shared_ptr<db> res,
+		const char* dbfile, const char* hdfinternalpath, const load_options &opts) {
 		if (!dbfile) SDBR_throw(scatdb::error::error_types::xBadInput)
 			.add<std::string>("Reason", "dbfile is null");
 		std::string sinternal;
@@ -38,15 +44,63 @@ namespace scatdb {
 			SDBR_throw(scatdb::error::error_types::xMissingKey)
 			.add<std::string>("Reason", "HDF5 path does not have the desired dataset.")
 			.add<std::string>("name", "intMat");
-		scatdb::plugins::hdf5::readDatasetEigen<
-			Eigen::Matrix<float, Eigen::Dynamic, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS, Eigen::RowMajor>, Group>
-			(grp, "floatMat", res->floatMat);
-		scatdb::plugins::hdf5::readDatasetEigen<
-			Eigen::Matrix<uint64_t, Eigen::Dynamic, data_entries::SDBR_NUM_DATA_ENTRIES_INTS>, Group>
-			(grp, "intMat", res->intMat);
+		if (opts.readsAll()) {
+			scatdb::plugins::hdf5::readDatasetEigen<
+				Eigen::Matrix<float, Eigen::Dynamic, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS, Eigen::RowMajor>, Group>
+				(grp, "floatMat", res->floatMat);
+			scatdb::plugins::hdf5::readDatasetEigen<
+				Eigen::Matrix<uint64_t, Eigen::Dynamic, data_entries::SDBR_NUM_DATA_ENTRIES_INTS>, Group>
+				(grp, "intMat", res->intMat);
+			return;
+		}
+
+		// Only read the selected rows and columns. Both datasets are stored
+		// row-major, like floatMat, so the same hyperslab in the file and in
+		// memory selects a column.
+		DataSet dfloats = grp->openDataSet("floatMat");
+		DataSet dints = grp->openDataSet("intMat");
+		DataSpace ffloats = dfloats.getSpace(), fints = dints.getSpace();
+		hsize_t fdims[2] = { 0, 0 }, idims[2] = { 0, 0 };
+		if (ffloats.getSimpleExtentNdims() != 2 || fints.getSimpleExtentNdims() != 2)
+			SDBR_throw(scatdb::error::error_types::xDimensionMismatch)
+			.add<std::string>("Reason", "floatMat and intMat must be two-dimensional.");
+		ffloats.getSimpleExtentDims(fdims);
+		fints.getSimpleExtentDims(idims);
+		if (fdims[1] != data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS
+			|| idims[1] != data_entries::SDBR_NUM_DATA_ENTRIES_INTS || fdims[0] != idims[0])
+			SDBR_throw(scatdb::error::error_types::xDimensionMismatch)
+			.add<std::string>("Reason", "floatMat and intMat have unexpected dimensions.")
+			.add<uint64_t>("floatRows", (uint64_t)fdims[0])
+			.add<uint64_t>("floatCols", (uint64_t)fdims[1])
+			.add<uint64_t>("intRows", (uint64_t)idims[0])
+			.add<uint64_t>("intCols", (uint64_t)idims[1]);
+		const hsize_t first = (opts.firstRow < fdims[0]) ? opts.firstRow : fdims[0];
+		const hsize_t n = (opts.numRows < fdims[0] - first) ? opts.numRows : fdims[0] - first;
+
+		res->floatMat.setConstant((Eigen::Index)n, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS,
+			std::numeric_limits<float>::quiet_NaN());
+		res->intMat.resize((Eigen::Index)n, data_entries::SDBR_NUM_DATA_ENTRIES_INTS);
+		if (!n) return;
+
+		hsize_t mdims[2] = { n, fdims[1] };
+		DataSpace mfloats(2, mdims);
+		bool any = false;
+		for (hsize_t j = 0; j < fdims[1]; ++j) {
+			if (!((opts.floatColumns >> j) & 1)) continue;
+			const hsize_t count[2] = { n, 1 };
+			const hsize_t fstart[2] = { first, j }, mstart[2] = { 0, j };
+			const H5S_seloper_t op = (any) ? H5S_SELECT_OR : H5S_SELECT_SET;
+			ffloats.selectHyperslab(op, count, fstart);
+			mfloats.selectHyperslab(op, count, mstart);
+			any = true;
+		}
+		if (any) dfloats.read(res->floatMat.data(), PredType::NATIVE_FLOAT, mfloats, ffloats);
 
-		//res->floatMat.resize(numLines, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS);
-		//res->intMat.resize(numLines, data_entries::SDBR_NUM_DATA_ENTRIES_INTS);
+		const hsize_t icount[2] = { n, idims[1] }, istart[2] = { first, 0 };
+		fints.selectHyperslab(H5S_SELECT_SET, icount, istart);
+		DataSpace mints(2, icount);
+		// intMat is column-major and has a single column, so it matches the file layout
+		dints.read(res->intMat.data(), PredType::NATIVE_UINT64, mints, fints);
 	}
 
 	void db::data_stats::writeHDF5File(std::shared_ptr<H5::Group> grp) const {
@@ -141,6 +195,16 @@ namespace scatdb {
 		//attr.write(*vls_type, testb.c_str());
 		//attr.write(*vls_type, testb);
 	}
+	void db_view::writeHDFfile(std::shared_ptr<H5::Group> grp) const {
+		// HDF5 needs the rows to be contiguous.
+		materialize()->writeHDFfile(grp);
+	}
+
+	void db_view::writeHDFfile(const char* filename,
+		SDBR_write_type wt, const char* hdfinternalpath) const {
+		materialize()->writeHDFfile(filename, wt, hdfinternalpath);
+	}
+
 	void db::writeHDFfile(const char* filename,
 		SDBR_write_type wt, const char* hdfinternalpath) const {
 		scatdb::plugins::hdf5::useZLIB(true);
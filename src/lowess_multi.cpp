@@ -0,0 +1,267 @@
+#include "../scatdb/defs.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "../private/lowess_multi.hpp"
+#include "../private/parallel.hpp"
+
+namespace {
+	/// Below this many points, everything runs on the calling thread
+	const size_t parallelPoints = 2048;
+	/// The tricube weights of every window are kept for the robustness
+	/// iterations when there are at most this many of them (64 MB).
+	const size_t maxStoredWeights = 1 << 23;
+
+	/// The walk over x made by ::lowess. It is the same for every response
+	/// and every iteration, so it is recorded once and then replayed.
+	struct step {
+		enum kinds { FIT, INTERP, COPY } kind;
+		/// FIT: the fitted point. INTERP: the end of the interpolated span.
+		/// COPY: the point that takes the value of from.
+		long i;
+		/// INTERP: the start of the span. COPY: the source point.
+		long from;
+		/// FIT: the points that get a weight, and the bandwidth
+		long nleft, nrt;
+		double h;
+	};
+
+	/// Is a point at distance r inside the window, as in ::lowest
+	inline bool inWindow(double r, double h9) { return r <= h9; }
+
+	/// Tricube weight of a point inside the window, as in ::lowest
+	inline double tricube(double r, double h, double h1) {
+		if (r <= h1) return 1.;
+		return (1.0 - (r / h)*(r / h)*(r / h))*(1.0 - (r / h)*(r / h)*(r / h))*(1.0 - (r / h)*(r / h)*(r / h));
+	}
+
+	/// Record the walk, including the rightmost point of each window
+	/// (which picks up ties on the right).
+	void planWalk(const std::vector<double> &x, long ns, double delta, std::vector<step> &steps) {
+		const long n = (long)x.size();
+		long nleft = 0, nright = ns - 1, last = -1, i = 0;
+		do {
+			while (nright < n - 1) {
+				const double d1 = x[i] - x[nleft];
+				const double d2 = x[nright + 1] - x[i];
+				if (d1 <= d2) break;
+				nleft++;
+				nright++;
+			}
+			step s;
+			s.kind = step::FIT;
+			s.i = i;
+			s.from = -1;
+			s.nleft = nleft;
+			s.h = std::max(x[i] - x[nleft], x[nright] - x[i]);
+			const double h9 = 0.999*s.h;
+			long j = nleft;
+			for (; j < n; j++) {
+				if (!inWindow(std::abs(x[j] - x[i]), h9) && x[j] > x[i]) break;
+			}
+			s.nrt = j - 1;
+			steps.push_back(s);
+			if (last < i - 1) {
+				step t;
+				t.kind = step::INTERP;
+				t.i = i;
+				t.from = last;
+				steps.push_back(t);
+			}
+			last = i;
+			const double cut = x[last] + delta;
+			for (i = last + 1; i < n; i++) {
+				if (x[i] > cut) break;
+				if (x[i] == x[last]) {
+					step t;
+					t.kind = step::COPY;
+					t.i = i;
+					t.from = last;
+					steps.push_back(t);
+					last = i;
+				}
+			}
+			i = std::max(last + 1, i - 1);
+		} while (last < n - 1);
+	}
+
+	/// Normalize the weights of one window and fold in the local linear fit,
+	/// as in ::lowest. Returns false if every weight is zero.
+	bool finishWeights(const std::vector<double> &x, const step &s, double range,
+		double* w, double a) {
+		if (a <= 0.) return false;
+		const double xs = x[s.i];
+		for (long j = s.nleft; j <= s.nrt; j++)
+			w[j] /= a;
+		if (s.h > 0.) {
+			a = 0.;
+			for (long j = s.nleft; j <= s.nrt; j++)
+				a += w[j] * x[j];
+			double b = xs - a;
+			double c = 0;
+			for (long j = s.nleft; j <= s.nrt; j++)
+				c += w[j] * (x[j] - a)*(x[j] - a);
+			if (std::sqrt(c) > 0.001*range) {
+				b /= c;
+				for (long j = s.nleft; j <= s.nrt; j++)
+					w[j] *= (1.0 + b*(x[j] - a));
+			}
+		}
+		return true;
+	}
+
+	/// Fill in the points between fits. ys holds numCols values per point.
+	void replay(const std::vector<double> &x, const std::vector<step> &steps,
+		double* ys, size_t numCols) {
+		for (const auto &s : steps) {
+			if (s.kind == step::INTERP) {
+				const long last = s.from;
+				const double denom = x[s.i] - x[last];
+				for (long j = last + 1; j < s.i; j++) {
+					const double alpha = (x[j] - x[last]) / denom;
+					for (size_t c = 0; c < numCols; ++c)
+						ys[j*numCols + c] = alpha * ys[s.i*numCols + c] + (1.0 - alpha)*ys[last*numCols + c];
+				}
+			} else if (s.kind == step::COPY) {
+				for (size_t c = 0; c < numCols; ++c)
+					ys[s.i*numCols + c] = ys[s.from*numCols + c];
+			}
+		}
+	}
+
+	/// Robustness weights from the residuals, as in ::lowess
+	void robustWeights(const std::vector<double> &res, std::vector<double> &rw) {
+		const long n = (long)res.size();
+		for (long i = 0; i < n; i++)
+			rw[i] = std::abs(res[i]);
+		std::sort(rw.begin(), rw.end());
+		long m1 = n / 2 + 1;
+		const long m2 = n - m1;
+		m1--;
+		const double cmad = 3.0 *(rw[m1] + rw[m2]);
+		const double c9 = .999*cmad;
+		const double c1 = .001*cmad;
+		for (long i = 0; i < n; i++) {
+			const double r = std::abs(res[i]);
+			if (r <= c1) rw[i] = 1;
+			else if (r > c9) rw[i] = 0;
+			else rw[i] = (1.0 - (r / cmad)*(r / cmad))*(1.0 - (r / cmad)*(r / cmad));
+		}
+	}
+}
+
+namespace scatdb {
+	namespace regression {
+		void lowessMulti(const std::vector<double> &x, const ResponseMatType &y,
+			double f, long nsteps, double delta, ResponseMatType &ys, size_t numThreads) {
+			const long n = (long)x.size();
+			const size_t numCols = (size_t)y.cols();
+			// Points that the walk never reaches are left at zero, as in ::lowess
+			ys.setZero(y.rows(), y.cols());
+			if ((n == 0) || ((long)y.rows() != n)) return;
+			if (n == 1) {
+				ys = y;
+				return;
+			}
+			const long ns = std::max(std::min((long)(f*n), n), (long)2);
+			const double range = x[n - 1] - x[0];
+			std::vector<step> steps;
+			planWalk(x, ns, delta, steps);
+			std::vector<size_t> fits;
+			for (size_t k = 0; k < steps.size(); ++k)
+				if (steps[k].kind == step::FIT) fits.push_back(k);
+			const size_t maxThreads = ((size_t)n < parallelPoints) ? 1 : numThreads;
+
+			// The tricube weights depend only on x. They are stored when they
+			// fit in the budget, and recomputed in every pass otherwise.
+			// Points outside of a window get a weight of zero.
+			std::vector<size_t> baseOff(fits.size() + 1, 0);
+			for (size_t k = 0; k < fits.size(); ++k)
+				baseOff[k + 1] = baseOff[k] + (size_t)(steps[fits[k]].nrt - steps[fits[k]].nleft + 1);
+			const bool storeBase = (nsteps > 0) && (baseOff.back() <= maxStoredWeights);
+			std::vector<double> base((storeBase) ? baseOff.back() : 0);
+			auto tricubes = [&](const step &s, double* bw) {
+				const double xs = x[s.i], h1 = 0.001*s.h, h9 = 0.999*s.h;
+				for (long j = s.nleft; j <= s.nrt; j++) {
+					const double r = std::abs(x[j] - xs);
+					bw[j - s.nleft] = (inWindow(r, h9)) ? tricube(r, s.h, h1) : 0.;
+				}
+			};
+
+			// First pass: the weights do not depend on the response, so each
+			// window's weights are found once and applied to all responses.
+			const size_t numWorkers = parallel::resolveThreads(maxThreads, fits.size());
+			parallel::runWorkers(numWorkers, [&](size_t t) {
+				std::vector<double> w((size_t)n), bwScratch((size_t)n);
+				const size_t begin = (fits.size() * t) / numWorkers;
+				const size_t end = (fits.size() * (t + 1)) / numWorkers;
+				for (size_t k = begin; k < end; ++k) {
+					const step &s = steps[fits[k]];
+					double* bw = (storeBase) ? base.data() + baseOff[k] : bwScratch.data();
+					tricubes(s, bw);
+					double a = 0;
+					for (long j = s.nleft; j <= s.nrt; j++) {
+						w[j] = bw[j - s.nleft];
+						a += w[j];
+					}
+					double* out = ys.data() + s.i*numCols;
+					if (!finishWeights(x, s, range, w.data(), a)) {
+						for (size_t c = 0; c < numCols; ++c) out[c] = y(s.i, c);
+						continue;
+					}
+					for (size_t c = 0; c < numCols; ++c) out[c] = 0;
+					for (long j = s.nleft; j <= s.nrt; j++) {
+						const double* yj = y.data() + j*numCols;
+						for (size_t c = 0; c < numCols; ++c)
+							out[c] += w[j] * yj[c];
+					}
+				}
+			});
+			replay(x, steps, ys.data(), numCols);
+			if (nsteps <= 0) return;
+
+			// Robustness iterations. Each response gets its own weights.
+			const size_t numColWorkers = parallel::resolveThreads(maxThreads, numCols);
+			parallel::runWorkers(numColWorkers, [&](size_t t) {
+				std::vector<double> yc((size_t)n), ysc((size_t)n), res((size_t)n),
+					rw((size_t)n), w((size_t)n), bwScratch((size_t)((storeBase) ? 0 : n));
+				for (size_t c = t; c < numCols; c += numColWorkers) {
+					for (long i = 0; i < n; ++i) {
+						yc[i] = y(i, c);
+						ysc[i] = ys(i, c);
+					}
+					for (long iter = 1; iter <= nsteps; ++iter) {
+						for (long i = 0; i < n; i++)
+							res[i] = yc[i] - ysc[i];
+						robustWeights(res, rw);
+						for (size_t k = 0; k < fits.size(); ++k) {
+							const step &s = steps[fits[k]];
+							const double* bw = base.data() + baseOff[k];
+							if (!storeBase) {
+								tricubes(s, bwScratch.data());
+								bw = bwScratch.data();
+							}
+							double a = 0;
+							for (long j = s.nleft; j <= s.nrt; j++) {
+								const double b = bw[j - s.nleft];
+								w[j] = (b != 0.) ? b * rw[j] : 0.;
+								a += w[j];
+							}
+							if (!finishWeights(x, s, range, w.data(), a)) {
+								ysc[s.i] = yc[s.i];
+								continue;
+							}
+							double v = 0;
+							for (long j = s.nleft; j <= s.nrt; j++)
+								v += w[j] * yc[j];
+							ysc[s.i] = v;
+						}
+						replay(x, steps, ysc.data(), 1);
+					}
+					for (long i = 0; i < n; ++i)
+						ys(i, c) = ysc[i];
+				}
+			});
+		}
+	}
+}
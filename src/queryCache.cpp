@@ -0,0 +1,102 @@
+#include "../scatdb/defs.hpp"
+#include <list>
+#include <map>
+#include <mutex>
+#include "../private/queryCache.hpp"
+
+namespace {
+	typedef scatdb::hash::HASH_t keyType;
+	struct entry {
+		keyType key;
+		std::shared_ptr<const scatdb::scatdb_base> obj;
+		uint64_t bytes;
+	};
+	/// The cached results, newest first. Guarded by m_cache.
+	std::list<entry> recent;
+	/// Where each key is in recent. Guarded by m_cache.
+	std::map<keyType, std::list<entry>::iterator> positions;
+	uint64_t cachedBytes = 0;
+	uint64_t cacheBudget = 0;
+	std::mutex m_cache;
+
+	/// Drop the oldest results until the rest fit in the budget.
+	/// Expects m_cache to be held.
+	void trim() {
+		while (recent.size() && cachedBytes > cacheBudget) {
+			cachedBytes -= recent.back().bytes;
+			positions.erase(recent.back().key);
+			recent.pop_back();
+		}
+	}
+}
+
+namespace scatdb {
+	namespace queryCache {
+		hash::HASH_t keyBuilder::key() const {
+			return *(hash::HASH(words.data(), (int)(words.size() * sizeof(uint64_t))));
+		}
+
+		bool enabled() {
+			std::lock_guard<std::mutex> lock(m_cache);
+			return cacheBudget != 0;
+		}
+
+		std::shared_ptr<const scatdb_base> find(const hash::HASH_t &k) {
+			std::lock_guard<std::mutex> lock(m_cache);
+			auto it = positions.find(k);
+			if (it == positions.end()) return nullptr;
+			recent.splice(recent.begin(), recent, it->second);
+			return it->second->obj;
+		}
+
+		void insert(const hash::HASH_t &k, std::shared_ptr<const scatdb_base> obj, uint64_t bytes) {
+			std::lock_guard<std::mutex> lock(m_cache);
+			if (bytes > cacheBudget) return;
+			auto it = positions.find(k);
+			if (it != positions.end()) {
+				// Another thread got here first. Keep its result.
+				recent.splice(recent.begin(), recent, it->second);
+				return;
+			}
+			entry e;
+			e.key = k;
+			e.obj = obj;
+			e.bytes = bytes;
+			recent.push_front(e);
+			positions[k] = recent.begin();
+			cachedBytes += bytes;
+			trim();
+		}
+
+		uint64_t bytesOf(const db &d) {
+			return (uint64_t)(sizeof(db) + (d.floatMat.size() * sizeof(float))
+				+ (d.intMat.size() * sizeof(uint64_t)) + (d.phaseMat.size() * sizeof(float)));
+		}
+
+		uint64_t bytesOf(const cachedRows &r) {
+			return (uint64_t)(sizeof(cachedRows) + (r.rows.capacity() * sizeof(uint64_t)));
+		}
+
+		uint64_t bytesOf(const db::data_stats &s) {
+			return (uint64_t)sizeof(db::data_stats) + ((s.srcdb) ? bytesOf(*(s.srcdb)) : 0);
+		}
+	}
+
+	void filter::setCacheBudget(uint64_t bytes) {
+		std::lock_guard<std::mutex> lock(m_cache);
+		cacheBudget = bytes;
+		trim();
+	}
+
+	uint64_t filter::getCacheBudget() {
+		std::lock_guard<std::mutex> lock(m_cache);
+		return cacheBudget;
+	}
+
+	void filter::clearCache() {
+		std::lock_guard<std::mutex> lock(m_cache);
+		recent.clear();
+		positions.clear();
+		cachedBytes = 0;
+	}
+}
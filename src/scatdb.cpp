@@ -1,382 +1,153 @@
 #include "../scatdb/defs.hpp"
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <iostream>
 #include <tuple>
 #include "../scatdb/scatdb.hpp"
 #include "../scatdb/lowess.hpp"
+#include "../private/lowess_multi.hpp"
+#include "../private/queryCache.hpp"
 #include "../scatdb/error.hpp"
 //#include "../../spline/spline.hpp"
 
+namespace {
+	/// The serial number of the next database object
+	std::atomic<uint64_t> nextSerial(1);
+	/// Guards pStats. It is held only to check or publish the statistics.
+	std::mutex m_dbStats;
+}
+
 namespace scatdb {
-	db::db() {}
+	db::db() : serial(nextSerial++) {}
 	db::~db() {}
 	scatdb_base::scatdb_base() {}
 	scatdb_base::~scatdb_base() {}
 	std::shared_ptr<const db::data_stats> db::getStats() const {
-		if (!this->pStats)
-			this->pStats = db::data_stats::generate(this);
+		{
+			std::lock_guard<std::mutex> lock(m_dbStats);
+			if (this->pStats) return this->pStats;
+		}
+		// Computed outside of the lock, so that other databases are not held
+		// up. If two threads race, the first result is kept.
+		auto res = db::data_stats::generate(this);
+		std::lock_guard<std::mutex> lock(m_dbStats);
+		if (!this->pStats) this->pStats = res;
 		return this->pStats;
 	}
 	db::data_stats::data_stats() : count(0) {}
 	db::data_stats::~data_stats() {}
 
-	std::shared_ptr<const db> db::sort(
-			db::data_entries::data_entries_floats xaxis) const {
-		std::shared_ptr<db> res(new db);
-			SDBR_throw(::scatdb::error::error_types::xUnimplementedFunction);
-
-		/*
-		// Convert from eigen arrays into vectors
-		std::vector<double> ar, freq, temp, aeff, md, cabs, cbk, cext, csca, g;
-		std::vector<int> ft;
-
-		auto convertCol = [&](int col, std::vector<double> &out, bool dolog) {
-			auto blk = floatMat.cast<float>().block(0,col,floatMat.rows(),1);
-			out.insert(out.begin(), blk.data(), blk.data() + floatMat.rows());
-			if (dolog) {
-				for (size_t i=0; i< out.size(); ++i)
-					out[i] = log10(out[i]);
-			}
-		};
-		auto convertColInt = [&](int col, std::vector<int> &out) {
-			auto blk = intMat.cast<int>().block(0,col,intMat.rows(),1);
-			out.insert(out.begin(), blk.data(), blk.data() + intMat.rows());
-		};
-		convertColInt(data_entries::SDBR_FLAKETYPE, ft);
-		convertCol(data_entries::SDBR_FREQUENCY_GHZ, freq, false);
-		convertCol(data_entries::SDBR_TEMPERATURE_K, temp, false);
-		convertCol(data_entries::SDBR_AEFF_UM, aeff, false);
-		convertCol(data_entries::SDBR_MAX_DIMENSION_MM, md, false);
-		convertCol(data_entries::SDBR_CABS_M, cabs, false);
-		convertCol(data_entries::SDBR_CBK_M, cbk, false);
-		convertCol(data_entries::SDBR_CEXT_M, cext, false);
-		convertCol(data_entries::SDBR_CSCA_M, csca, false);
-		convertCol(data_entries::SDBR_G, g, false);
-		convertCol(data_entries::SDBR_AS_XY, ar, false);
-
-		// Another slow operation to convert everything to tuples, sort based on x axis,
-		// and then convert back to the vector forms.
-		typedef std::tuple<int,double,double,double,double,double,double,double,double,double,double> sInner;
-		std::vector< sInner > vsort;
-		for (size_t i=0; i < aeff.size(); ++i)
-			vsort.push_back( sInner (
-				ft[i], freq[i], temp[i], aeff[i], md[i], cabs[i], cbk[i], cext[i], csca[i], g[i], ar[i]));
-		if (xaxis == db::data_entries::SDBR_AEFF_UM)
-			std::sort(vsort.begin(), vsort.end(), [](
-			sInner lhs, sInner rhs) {
-					if (std::get<3>(lhs) != std::get<3>(rhs))
-						return std::get<3>(lhs) < std::get<3>(rhs);
-					return std::get<4>(lhs) < std::get<4>(rhs);
-				});
-		else
-			std::sort(vsort.begin(), vsort.end(), [](
-			sInner lhs, sInner rhs) {
-					if (std::get<4>(lhs) != std::get<4>(rhs))
-						return std::get<4>(lhs) < std::get<4>(rhs);
-					return std::get<3>(lhs) < std::get<3>(rhs);
-				});
-		for (size_t i=0; i < vsort.size(); ++i) {
-			ft[i] = std::get<0>(vsort[i]);
-			freq[i] = std::get<1>(vsort[i]);
-			temp[i] = std::get<2>(vsort[i]);
-			aeff[i] = std::get<3>(vsort[i]);
-			md[i] = std::get<4>(vsort[i]);
-			cabs[i] = std::get<5>(vsort[i]);
-			cbk[i] = std::get<6>(vsort[i]);
-			cext[i] = std::get<7>(vsort[i]);
-			csca[i] = std::get<8>(vsort[i]);
-			g[i] = std::get<9>(vsort[i]);
-			ar[i] = std::get<10>(vsort[i]);
-
-		}
-
-		FloatMatType nfm;
-		IntMatType nfi;
-		nfm.resize(vsort.size(), floatMat.cols());
-		nfi.resize(vsort.size(), intMat.cols());
-		//nfm = floatMat;
-		//nfi = intMat;
-
-		nfm.fill(-999);
-		nfi.fill(-999);
-
-		//res->intMat.resize(intMat.rows(), intMat.cols());
-
-		auto revertCol = [&](int col, const std::vector<double> &in, bool islog) {
-			auto blk = nfm.block(0,col,nfm.rows(),1);
-			for (size_t i=0; i<(size_t) nfm.rows(); ++i) {
-				if (!islog)
-					blk(i,0) = (float) in[i];
-				else
-					blk(i,0) = pow(10.f,(float) in[i]);
-			}
-		};
-		auto revertColInt = [&](int col, const std::vector<int> &in) {
-			auto blk = nfi.block(0,col,nfi.rows(),1);
-			for (size_t i=0; i<(size_t)nfi.rows(); ++i) {
-				blk(i,0) = (int) in[i];
+	namespace {
+		/// Shared by db::regress and db_view::regress. If rows is set, only
+		/// those rows of src are regressed.
+		void regressRows(const db* src, const db::RowIdsType* rows,
+			std::shared_ptr<const db::data_stats> stats,
+			db::data_entries::data_entries_floats xaxis,
+			double f, uint64_t nsteps, double delta,
+			db::FloatMatType &nfm, db::IntMatType &nfi) {
+			typedef db::data_entries data_entries;
+			// First, get the stats. Want min and max values for effective radius.
+			double minRad = stats->floatStats(data_entries::SDBR_S_MIN,xaxis),
+				   maxRad = stats->floatStats(data_entries::SDBR_S_MAX,xaxis);
+
+			double low = 0, high = 0;
+			if (xaxis == db::data_entries::SDBR_AEFF_UM) {
+				low = (double) ((int) (minRad/10.)) * 10.;
+				high = (double) ((int) (maxRad/10.)+1) * 10.;
+			} else if (xaxis == db::data_entries::SDBR_MAX_DIMENSION_MM) {
+				low = (double) (((int) (minRad*10.)) / 10);
+				high = (double) (((int) (maxRad*10.)+1) / 10);
 			}
-		};
-		revertCol(data_entries::SDBR_AS_XY, ar, false);
-		revertCol(data_entries::SDBR_FREQUENCY_GHZ, freq, false);
-		revertCol(data_entries::SDBR_TEMPERATURE_K, temp, false);
-		revertCol(data_entries::SDBR_AEFF_UM, aeff, false);
-		revertCol(data_entries::SDBR_MAX_DIMENSION_MM, md, false);
-		revertCol(data_entries::SDBR_CABS_M, cabs, false);
-		revertCol(data_entries::SDBR_CBK_M, cbk, false);
-		revertCol(data_entries::SDBR_CEXT_M, cext, false);
-		revertCol(data_entries::SDBR_CSCA_M, csca, false);
-		revertCol(data_entries::SDBR_G, g, false);
-		revertColInt(data_entries::SDBR_FLAKETYPE, ft);
-
-		res->floatMat = nfm;
-		res->intMat = nfi;
-		*/
-		return res;
-	}
-
-	/*
-	std::shared_ptr<const db> db::interpolate(
-			db::data_entries::SDBR_data_entries_floats xaxis) const {
-		std::shared_ptr<db> res(new db);
-		// First, get the stats. Want min and max values for effective radius.
-		auto stats = this->getStats();
-		double minRad = stats->floatStats(data_entries::SDBR_S_MIN,xaxis),
-			   maxRad = stats->floatStats(data_entries::SDBR_S_MAX,xaxis);
-
-		double low = 0, high = 0;
-		if (xaxis == db::data_entries::SDBR_AEFF_UM) {
-			low = (double) ((int) (minRad/10.)) * 10.;
-			high = (double) ((int) (maxRad/10.)+1) * 10.;
-		} else if (xaxis == db::data_entries::SDBR_MAX_DIMENSION_MM) {
-			low = (double) (((int) (minRad*10.)) / 10);
-			high = (double) (((int) (maxRad*10.)+1) / 10);
-		}
-
-		// Convert from eigen arrays into vectors
-		std::vector<double> aeff, cabs, cbk, cext, csca, g,
-			rcabs, rcbk, rcext, rcsca, rg,
-			icabs, icbk, icext, icsca, ig,
-			rw, residuals, lx, lcabs, lcbk, lcext, lcsca, lg;
-
 
-		auto convertCol = [&](int col, std::vector<double> &out, bool dolog) {
-			auto blk = floatMat.cast<float>().block(0,col,floatMat.rows(),1);
-			out.insert(out.begin(), blk.data(), blk.data() + floatMat.rows());
-			if (dolog) {
-				for (size_t i=0; i< out.size(); ++i)
-					out[i] = log10(out[i]);
+			// The five responses are fitted together over the same x axis.
+			// Each is a column of y, and the cross sections are fitted in log space.
+			const int respCols[] = { data_entries::SDBR_CABS_M, data_entries::SDBR_CBK_M,
+				data_entries::SDBR_CEXT_M, data_entries::SDBR_CSCA_M, data_entries::SDBR_G };
+			const bool respLog[] = { true, true, true, true, false };
+			const size_t numResp = sizeof(respCols) / sizeof(respCols[0]);
+			const int xcol = (xaxis == db::data_entries::SDBR_AEFF_UM)
+				? data_entries::SDBR_AEFF_UM : data_entries::SDBR_MAX_DIMENSION_MM;
+
+			// floatMat is row-major, so a column is either read from the column
+			// store or gathered with a stride of one row.
+			std::shared_ptr<const db::data_columns> cols;
+			if (db::useColumnStore()) cols = src->getColumns();
+			const size_t numRows = (rows) ? rows->size() : (size_t)src->floatMat.rows();
+			auto colData = [&](int col, size_t &stride) -> const float* {
+				stride = (cols) ? 1 : (size_t)src->floatMat.cols();
+				return (cols) ? cols->floatData(col) : src->floatMat.data() + col;
+			};
+			auto rowOf = [&](size_t i) -> size_t { return (rows) ? (size_t)(*rows)[i] : i; };
+
+			std::vector<double> aeff(numRows);
+			{
+				size_t stride = 0;
+				const float* p = colData(xcol, stride);
+				for (size_t i = 0; i < numRows; ++i)
+					aeff[i] = (double)p[rowOf(i)*stride];
 			}
-		};
-		if (xaxis == data_entries::SDBR_AEFF_UM)
-			convertCol(data_entries::SDBR_AEFF_UM, aeff, false);
-		else
-			convertCol(data_entries::SDBR_MAX_DIMENSION_MM, aeff, false);
-		convertCol(data_entries::SDBR_CABS_M, cabs, false);
-		convertCol(data_entries::SDBR_CBK_M, cbk, false);
-		convertCol(data_entries::SDBR_CEXT_M, cext, false);
-		convertCol(data_entries::SDBR_CSCA_M, csca, false);
-		convertCol(data_entries::SDBR_G, g, false);
-
-		// Another slow operation to convert everything to tuples, sort based on x axis,
-		// and then convert back to the vector forms.
-		typedef std::tuple<double,double,double,double,double,double> sInner;
-		std::vector< sInner > vsort;
-		for (size_t i=0; i < aeff.size(); ++i)
-			vsort.push_back( sInner (
-				aeff[i], cabs[i], cbk[i], cext[i], csca[i], g[i]));
-		std::sort(vsort.begin(), vsort.end(), [](
-			sInner lhs, sInner rhs) {
-					return std::get<0>(lhs) < std::get<0>(rhs);
-				});
-		for (size_t i=0; i < vsort.size(); ++i) {
-			aeff[i] = std::get<0>(vsort[i]);
-			cabs[i] = std::get<1>(vsort[i]);
-			cbk[i] = std::get<2>(vsort[i]);
-			cext[i] = std::get<3>(vsort[i]);
-			csca[i] = std::get<4>(vsort[i]);
-			g[i] = std::get<5>(vsort[i]);
-		}
-
-		const int sz = (int)(high-low+1)/10;
-		lx.reserve(sz);
-		lcabs.reserve(sz);
-		lcbk.reserve(sz);
-		lcext.reserve(sz);
-		lcsca.reserve(sz);
-		lg.reserve(sz);
-		double span = 10;
-		if (xaxis == data_entries::SDBR_MAX_DIMENSION_MM)
-			span = 0.1;
-
-		for (double x = low; x <= high; x += span) {
-			lx.push_back(x);
-		}
-
-		// Call interpolation engine here
-		//double *spline_cubic_set ( int n, double t[], double y[], int ibcbeg, 
-		//	double ybcbeg, int ibcend, double ybcend );
-		//double spline_cubic_val ( int n, double t[], double y[], double ypp[], 
-		//	double tval, double *ypval, double *yppval );
-		auto splineit = [&](std::vector<double> &ys, std::vector<double> &iys) {
-			// Really inefficient filtering... Spline code cannot have duplicate x values
-			std::vector<double> fxs, fys;
-			fxs.reserve(aeff.size()); fys.reserve(aeff.size());
-			double last = -9999;
-			for (size_t i=0; i<aeff.size(); ++i) {
-				double x = aeff[i];
-				double y = ys[i];
-				if (abs((last/x)-1) < 0.000001 || last >= x) {
-					// Already tested.
-					//std::cerr << "Ignoring x " << x << " with last " << last << std::endl;
-					continue;
+			regression::ResponseMatType y((Eigen::Index)numRows, (Eigen::Index)numResp), ys;
+			for (size_t c = 0; c < numResp; ++c) {
+				size_t stride = 0;
+				const float* p = colData(respCols[c], stride);
+				if (respLog[c]) {
+					for (size_t i = 0; i < numRows; ++i)
+						y((Eigen::Index)i, (Eigen::Index)c) = log10((double)p[rowOf(i)*stride]);
+				} else {
+					for (size_t i = 0; i < numRows; ++i)
+						y((Eigen::Index)i, (Eigen::Index)c) = (double)p[rowOf(i)*stride];
 				}
-				fxs.push_back(x);
-				fys.push_back(y);
-				last = x;
-				//std::cerr << x << std::endl;
-			}
-			//
-			double *aeffpp = spline_cubic_set(
-				(int) fxs.size(), fxs.data(), fys.data(),
-				0, 0, 0, 0);
-
-
-			for (double x = low; x <= high; x += span) {
-				double ypval = 0, yppval = 0;
-				double val = spline_cubic_val((int) fxs.size(), fxs.data(), fys.data(), aeffpp,
-					x, &ypval, &yppval);
-				iys.push_back(val);
 			}
-			delete[] aeffpp;
-		};
 
-		splineit(cabs, lcabs);
-		splineit(cbk, lcbk);
-		splineit(cext, lcext);
-		splineit(csca, lcsca);
-		splineit(g, lg);
+			regression::lowessMulti(aeff, y, f, (long)nsteps, delta, ys);
 
-		FloatMatType nfm;
-		IntMatType nfi;
-		nfm.resize(lx.size(), floatMat.cols());
-		nfi.resize(lx.size(), intMat.cols());
-		//nfm = floatMat;
-		//nfi = intMat;
+			nfm.resize((Eigen::Index)numRows, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS);
+			nfi.resize((Eigen::Index)numRows, data_entries::SDBR_NUM_DATA_ENTRIES_INTS);
 
-		nfm.fill(-999);
-		nfi.fill(-999);
+			nfm.block(0,0,nfm.rows(),nfm.cols()).fill(-999);
+			nfi.block(0,0,nfi.rows(),nfi.cols()).fill(-999);
 
-		//res->intMat.resize(intMat.rows(), intMat.cols());
-
-		auto revertCol = [&](int col, const std::vector<double> &in, bool islog) {
-			auto blk = nfm.block(0,col,nfm.rows(),1);
-			for (size_t i=0; i<(size_t)nfm.rows(); ++i) {
-				if (!islog)
-					blk(i,0) = (float) in[i];
-				else
-					blk(i,0) = pow(10.f,(float) in[i]);
+			for (size_t i=0; i<numRows; ++i)
+				nfm((Eigen::Index)i, xcol) = (float) aeff[i];
+			for (size_t c = 0; c < numResp; ++c) {
+				for (size_t i=0; i<numRows; ++i) {
+					const double v = ys((Eigen::Index)i, (Eigen::Index)c);
+					nfm((Eigen::Index)i, respCols[c]) = (respLog[c]) ? pow(10.f, (float) v) : (float) v;
+				}
 			}
-		};
-		if (xaxis == db::data_entries::SDBR_AEFF_UM)
-			revertCol(data_entries::SDBR_AEFF_UM, lx, false);
-		else
-			revertCol(data_entries::SDBR_MAX_DIMENSION_MM, lx, false);
-		revertCol(data_entries::SDBR_CABS_M, lcabs, false);
-		revertCol(data_entries::SDBR_CBK_M, lcbk, false);
-		revertCol(data_entries::SDBR_CEXT_M, lcext, false);
-		revertCol(data_entries::SDBR_CSCA_M, lcsca, false);
-		revertCol(data_entries::SDBR_G, lg, false);
-
-		res->floatMat = nfm;
-		res->intMat = nfi;
-		return res;
+		}
 	}
-	*/
 
 	std::shared_ptr<const db> db::regress(
 		db::data_entries::data_entries_floats xaxis,
 		double f, uint64_t nsteps, double delta) const {
-		std::shared_ptr<db> res(new db);
-
-		// First, get the stats. Want min and max values for effective radius.
-		auto stats = this->getStats();
-		double minRad = stats->floatStats(data_entries::SDBR_S_MIN,xaxis),
-			   maxRad = stats->floatStats(data_entries::SDBR_S_MAX,xaxis);
-
-		double low = 0, high = 0;
-		if (xaxis == db::data_entries::SDBR_AEFF_UM) {
-			low = (double) ((int) (minRad/10.)) * 10.;
-			high = (double) ((int) (maxRad/10.)+1) * 10.;
-		} else if (xaxis == db::data_entries::SDBR_MAX_DIMENSION_MM) {
-			low = (double) (((int) (minRad*10.)) / 10);
-			high = (double) (((int) (maxRad*10.)+1) / 10);
-		}
-
-		// Convert from eigen arrays into vectors
-		std::vector<double> aeff, cabs, cbk, cext, csca, g,
-			rcabs, rcbk, rcext, rcsca, rg,
-			icabs, icbk, icext, icsca, ig,
-			rw, residuals, lx, lcabs, lcbk, lcext, lcsca, lg;
-		auto convertCol = [&](int col, std::vector<double> &out, bool dolog) {
-			auto blk = floatMat.cast<float>().block(0,col,floatMat.rows(),1);
-			out.insert(out.begin(), blk.data(), blk.data() + floatMat.rows());
-			if (dolog) {
-				for (size_t i=0; i< out.size(); ++i)
-					out[i] = log10(out[i]);
-			}
-		};
-		if (xaxis == db::data_entries::SDBR_AEFF_UM)
-			convertCol(data_entries::SDBR_AEFF_UM, aeff, false);
-		else
-			convertCol(data_entries::SDBR_MAX_DIMENSION_MM, aeff, false);
-		convertCol(data_entries::SDBR_CABS_M, cabs, true);
-		convertCol(data_entries::SDBR_CBK_M, cbk, true);
-		convertCol(data_entries::SDBR_CEXT_M, cext, true);
-		convertCol(data_entries::SDBR_CSCA_M, csca, true);
-		convertCol(data_entries::SDBR_G, g, false);
-
-		lowess(aeff, cabs, f, (long) nsteps, delta, rcabs, rw, residuals);
-		lowess(aeff, cbk, f, (long) nsteps, delta, rcbk, rw, residuals);
-		lowess(aeff, cext, f, (long) nsteps, delta, rcext, rw, residuals);
-		lowess(aeff, csca, f, (long) nsteps, delta, rcsca, rw, residuals);
-		lowess(aeff, g, f, (long) nsteps, delta, rg, rw, residuals);
-
-		FloatMatType nfm;
-		IntMatType nfi;
-		//nfm.resize(lx.size(), floatMat.cols());
-		//nfi.resize(lx.size(), intMat.cols());
-		nfm = floatMat;
-		nfi = intMat;
-
-		nfm.block(0,0,nfm.rows(),nfm.cols()).fill(-999);
-		nfi.block(0,0,nfi.rows(),nfi.cols()).fill(-999);
-
-		//res->intMat.resize(intMat.rows(), intMat.cols());
-
-		auto revertCol = [&](int col, const std::vector<double> &in, bool islog) {
-			auto blk = nfm.block(0,col,nfm.rows(),1);
-			for (size_t i=0; i<(size_t)nfm.rows(); ++i) {
-				if (!islog)
-					blk(i,0) = (float) in[i];
-				else
-					blk(i,0) = pow(10.f,(float) in[i]);
-			}
-		};
-		if (xaxis == db::data_entries::SDBR_AEFF_UM)
-			revertCol(data_entries::SDBR_AEFF_UM, aeff, false);
-		else
-			revertCol(data_entries::SDBR_MAX_DIMENSION_MM, aeff, false);
-		revertCol(data_entries::SDBR_CABS_M, rcabs, true);
-		revertCol(data_entries::SDBR_CBK_M, rcbk, true);
-		revertCol(data_entries::SDBR_CEXT_M, rcext, true);
-		revertCol(data_entries::SDBR_CSCA_M, rcsca, true);
-		revertCol(data_entries::SDBR_G, rg, false);
+		return queryCache::memoize<db>([&]() {
+			return queryCache::keyBuilder(queryCache::kinds::REGRESS)
+				.add(serial).add((uint64_t)0).add((uint64_t)0)
+				.add((uint64_t)xaxis).add(f).add(nsteps).add(delta);
+		}, [&]() {
+			std::shared_ptr<db> res(new db);
+			regressRows(this, nullptr, this->getStats(), xaxis, f, nsteps, delta,
+				res->floatMat, res->intMat);
+			return res;
+		});
+	}
 
-		res->floatMat = nfm;
-		res->intMat = nfi;
-		return res;
+	std::shared_ptr<const db> db_view::regress(
+		db::data_entries::data_entries_floats xaxis,
+		double f, uint64_t nsteps, double delta) const {
+		return queryCache::memoize<db>([&]() {
+			return queryCache::keyBuilder(queryCache::kinds::REGRESS)
+				.add(parent->serial).add(*rowsHash())
+				.add((uint64_t)xaxis).add(f).add(nsteps).add(delta);
+		}, [&]() {
+			std::shared_ptr<db> res(new db);
+			regressRows(parent.get(), &rows, this->getStats(), xaxis, f, nsteps, delta,
+				res->floatMat, res->intMat);
+			return res;
+		});
 	}
 
 	template<>
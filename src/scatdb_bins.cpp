@@ -0,0 +1,142 @@
+#include "../scatdb/defs.hpp"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include "../scatdb/error.hpp"
+#include "../scatdb/scatdb.hpp"
+
+namespace scatdb {
+	db::data_bins::data_bins() : varnum(0) {}
+	db::data_bins::~data_bins() {}
+
+	size_t db::data_bins::numBins() const {
+		return (offsets.size()) ? offsets.size() - 1 : 0;
+	}
+
+	uint64_t db::data_bins::count(size_t bin) const {
+		if (bin >= numBins()) SDBR_throw(scatdb::error::error_types::xArrayOutOfBounds)
+			.add<uint64_t>("bin", (uint64_t)bin)
+			.add<uint64_t>("numBins", (uint64_t)numBins());
+		return offsets[bin + 1] - offsets[bin];
+	}
+
+	db::RowIdsType db::data_bins::getRows(size_t bin) const {
+		count(bin);
+		return RowIdsType(rows.begin() + (size_t)offsets[bin], rows.begin() + (size_t)offsets[bin + 1]);
+	}
+
+	std::shared_ptr<const db::data_bins> db::data_bins::generate(const db* src,
+		data_entries::data_entries_floats col, const std::vector<float> &edges) {
+		return generate(src, col, edges, nullptr);
+	}
+
+	std::shared_ptr<const db::data_bins> db::data_bins::generate(const db* src,
+		data_entries::data_entries_floats col, const std::vector<float> &edges,
+		const RowIdsType &rows) {
+		return generate(src, col, edges, &rows);
+	}
+
+	std::shared_ptr<const db::data_bins> db::data_bins::generate(const db* src,
+		data_entries::data_entries_floats col, const std::vector<float> &edges,
+		const RowIdsType *within) {
+		if (!src) SDBR_throw(scatdb::error::error_types::xNullPointer)
+			.add<std::string>("Reason", "The source database is NULL.");
+		if ((int)col < 0 || (int)col >= data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS)
+			SDBR_throw(scatdb::error::error_types::xArrayOutOfBounds)
+			.add<int>("col", (int)col);
+		if (edges.size() < 2) SDBR_throw(scatdb::error::error_types::xBadInput)
+			.add<std::string>("Reason", "At least two bin edges are needed.")
+			.add<uint64_t>("numEdges", (uint64_t)edges.size());
+		for (size_t i = 0; i < edges.size(); ++i) {
+			if (std::isnan(edges[i]) || (i && edges[i] < edges[i - 1]))
+				SDBR_throw(scatdb::error::error_types::xBadInput)
+				.add<std::string>("Reason", "Bin edges must be ascending and cannot be NaN.")
+				.add<uint64_t>("edge", (uint64_t)i)
+				.add<float>("value", edges[i]);
+		}
+
+		std::shared_ptr<db::data_bins> res(new db::data_bins);
+		res->varnum = (int)col;
+		res->edges = edges;
+		const size_t numBins = edges.size() - 1;
+		const size_t numLines = (within) ? within->size() : (size_t)src->floatMat.rows();
+		auto rowId = [&](size_t i) -> uint64_t { return (within) ? (*within)[i] : (uint64_t)i; };
+
+		const float* vals = nullptr;
+		size_t stride = data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS;
+		std::shared_ptr<const data_columns> cols;
+		if (db::useColumnStore()) {
+			cols = src->getColumns();
+			vals = cols->floatData(col);
+			stride = 1;
+		} else vals = src->floatMat.data() + col;
+
+		// Find each row's bin and count the bin sizes. Rows that fall outside
+		// of every bin (including NaNs) are marked with numBins.
+		std::vector<size_t> binOf(numLines);
+		std::vector<uint64_t> counts(numBins + 1, 0);
+		for (size_t i = 0; i < numLines; ++i) {
+			const float v = vals[rowId(i) * stride];
+			size_t b = (size_t)(std::upper_bound(edges.begin(), edges.end(), v) - edges.begin());
+			b = (b == 0 || b > numBins) ? numBins : b - 1;
+			binOf[i] = b;
+			counts[b]++;
+		}
+		// An exclusive prefix sum gives the start of each bin, and a stable
+		// scatter keeps the original row order within each bin.
+		res->offsets.assign(numBins + 1, 0);
+		for (size_t b = 0; b < numBins; ++b)
+			res->offsets[b + 1] = res->offsets[b] + counts[b];
+		res->rows.resize((size_t)res->offsets[numBins]);
+		std::vector<uint64_t> pos(res->offsets.begin(), res->offsets.end() - 1);
+		for (size_t i = 0; i < numLines; ++i) {
+			if (binOf[i] == numBins) continue;
+			res->rows[(size_t)pos[binOf[i]]++] = rowId(i);
+		}
+		return res;
+	}
+
+	std::shared_ptr<const db::data_bins> db::binBy(data_entries::data_entries_floats col,
+		const std::vector<float> &edges) const {
+		return data_bins::generate(this, col, edges);
+	}
+
+	std::vector<std::shared_ptr<const db::data_stats> > db::binStats(
+		data_entries::data_entries_floats col, const std::vector<float> &edges) const {
+		auto bins = binBy(col, edges);
+		std::vector<std::shared_ptr<const data_stats> > res;
+		res.reserve(bins->numBins());
+		for (size_t b = 0; b < bins->numBins(); ++b)
+			res.push_back(data_stats::generate(this, bins->getRows(b)));
+		return res;
+	}
+
+	std::shared_ptr<const db::data_bins> db_view::binBy(db::data_entries::data_entries_floats col,
+		const std::vector<float> &edges) const {
+		return db::data_bins::generate(parent.get(), col, edges, rows);
+	}
+
+	std::vector<std::shared_ptr<const db_view> > db_view::binViews(
+		db::data_entries::data_entries_floats col, const std::vector<float> &edges) const {
+		auto bins = binBy(col, edges);
+		std::vector<std::shared_ptr<const db_view> > res;
+		res.reserve(bins->numBins());
+		for (size_t b = 0; b < bins->numBins(); ++b) {
+			std::shared_ptr<db_view> v(new db_view);
+			v->parent = parent;
+			v->rows = bins->getRows(b);
+			res.push_back(v);
+		}
+		return res;
+	}
+
+	std::vector<std::shared_ptr<const db::data_stats> > db_view::binStats(
+		db::data_entries::data_entries_floats col, const std::vector<float> &edges) const {
+		auto bins = binBy(col, edges);
+		std::vector<std::shared_ptr<const db::data_stats> > res;
+		res.reserve(bins->numBins());
+		for (size_t b = 0; b < bins->numBins(); ++b)
+			res.push_back(db::data_stats::generate(parent.get(), bins->getRows(b)));
+		return res;
+	}
+}
@@ -1,11 +1,16 @@
 #include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <fstream>
 #include <iostream>
-#include <map>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <sstream>
 #include <string>
+#include <typeinfo>
+#include <unordered_map>
 #include <vector>
 #include <boost/program_options.hpp>
 #include "../scatdb/debug.hpp"
@@ -14,23 +19,107 @@
 #include "../scatdb/scatdb.hpp"
 
 namespace {
-	std::string lastErr;
-	std::map<const scatdb::scatdb_base*, std::shared_ptr<const scatdb::scatdb_base> > ptrs;
-	//std::vector<std::shared_ptr<const scatdb::scatdb_base> > ptrs;
-	// TODO: add casting checks again
+	/// Error message from the last C API call made on this thread
+	thread_local std::string lastErr;
+
+	/// The handles given out by the C API. Each handle is counted every time
+	/// it is returned (the load cache can hand back the same database twice),
+	/// and it stays valid until SDBR_free has been called as many times.
+	/// The table is split into shards, each with its own lock, so that threads
+	/// working on different handles rarely wait on one another. Locks are only
+	/// held to find, add or remove an entry, never while a handle is in use.
+	class handleRegistry {
+		struct entry {
+			std::shared_ptr<const scatdb::scatdb_base> obj;
+			uint64_t refs;
+		};
+		struct shard {
+			std::mutex m;
+			std::unordered_map<const void*, entry> entries;
+		};
+		static const size_t numShards = 16;
+		shard shards[numShards];
+		shard& shardFor(const void* p) {
+			// Heap addresses are aligned, so drop the low bits first
+			return shards[(((uintptr_t)p) >> 6) % numShards];
+		}
+	public:
+		SDBR_HANDLE add(std::shared_ptr<const scatdb::scatdb_base> obj) {
+			const void* key = obj.get();
+			shard& s = shardFor(key);
+			std::lock_guard<std::mutex> lock(s.m);
+			auto it = s.entries.find(key);
+			if (it == s.entries.end()) {
+				entry e;
+				e.obj = obj;
+				e.refs = 1;
+				s.entries.insert(std::make_pair(key, e));
+			} else ++(it->second.refs);
+			return (SDBR_HANDLE)(key);
+		}
+		std::shared_ptr<const scatdb::scatdb_base> get(SDBR_HANDLE h) {
+			shard& s = shardFor(h);
+			std::lock_guard<std::mutex> lock(s.m);
+			auto it = s.entries.find(h);
+			if (it == s.entries.end()) return nullptr;
+			return it->second.obj;
+		}
+		bool release(SDBR_HANDLE h) {
+			std::shared_ptr<const scatdb::scatdb_base> last;
+			{
+				shard& s = shardFor(h);
+				std::lock_guard<std::mutex> lock(s.m);
+				auto it = s.entries.find(h);
+				if (it == s.entries.end()) return false;
+				if (--(it->second.refs)) return true;
+				last = it->second.obj;
+				s.entries.erase(it);
+			}
+			// The object is destroyed here, outside of the lock.
+			return true;
+		}
+	};
+
+	handleRegistry& handles() {
+		static handleRegistry reg;
+		return reg;
+	}
+
+	/// Look up a database handle. Throws std::bad_cast if the handle is unknown
+	/// or refers to something other than a database.
+	std::shared_ptr<const scatdb::db> getDB(SDBR_HANDLE handle) {
+		auto h = std::dynamic_pointer_cast<const scatdb::db>(handles().get(handle));
+		if (!h) throw std::bad_cast();
+		return h;
+	}
+
+	/// Shared by the SDBR_count functions. addFilter adds the predicate.
+	template <class F>
+	uint64_t countWith(SDBR_HANDLE handle, const char* fname, F addFilter) {
+		using namespace scatdb;
+		try {
+			auto h = getDB(handle);
+			auto f = filter::generate();
+			addFilter(*f);
+			const uint64_t res = f->count(h);
+			lastErr = "";
+			return res;
+		}
+		catch (std::bad_cast &) {
+			lastErr = std::string("Passed handle in ") + fname + " is not a database handle.";
+			return 0;
+		}
+		catch (std::exception &e) {
+			lastErr = std::string(e.what());
+			return 0;
+		}
+	}
 }
 
 extern "C" {
 
 	bool SDBR_free(SDBR_HANDLE h) {
-		using namespace scatdb;
-		scatdb_base* hp = (scatdb_base*) (h);
-		if (ptrs.count(hp)) {
-			ptrs[hp].reset();
-			return true;
-		}
-		return false;
-		return false;
+		return handles().release(h);
 	}
 
 	int SDBR_err_len() {
@@ -72,10 +161,9 @@ extern "C" {
 		using namespace scatdb;
 		try {
 			auto d = db::loadDB(dbfile);
-			ptrs[d.get()] = d;
-			//ptrs.push_back(d);
+			SDBR_HANDLE res = handles().add(d);
 			lastErr = "";
-			return (SDBR_HANDLE)(d.get());
+			return res;
 		} catch (std::exception &e) {
 			lastErr = std::string(e.what());
 			return 0;
@@ -85,8 +173,7 @@ extern "C" {
 	bool SDBR_writeDBtext(SDBR_HANDLE handle, const char* outfile) {
 		using namespace scatdb;
 		try {
-			const scatdb_base* hp = ( const scatdb_base* )(handle);
-			const db* h = dynamic_cast<const db*>(hp);
+			auto h = getDB(handle);
 			std::ofstream out(outfile);
 			(h)->print(out);
 			lastErr="";
@@ -104,8 +191,7 @@ extern "C" {
 		SDBR_write_type wt, const char* hdfpath) {
 		using namespace scatdb;
 		try {
-			const scatdb_base* hp = ( const scatdb_base* )(handle);
-			const db* h = dynamic_cast<const db*>(hp);
+			auto h = getDB(handle);
 			(h)->writeHDFfile(outfile, wt, hdfpath);
 			lastErr="";
 		} catch (std::bad_cast &) {
@@ -118,13 +204,11 @@ extern "C" {
 		return true;
 	}
 
-	uint64_t SDBR_getNumRows(SDBR_HANDLE handle) {
+	bool SDBR_writeDBbinary(SDBR_HANDLE handle, const char* outfile) {
 		using namespace scatdb;
-		uint64_t res = 0;
 		try {
-			const scatdb_base* hp = ( const scatdb_base* )(handle);
-			const db* h = dynamic_cast<const db*>(hp);
-			res = (uint64_t) (h)->floatMat.rows();
+			auto h = getDB(handle);
+			(h)->writeBinaryFile(outfile);
 			lastErr="";
 		} catch (std::bad_cast &) {
 			lastErr = "Passed handle in SDBR_writeDB is not a database handle.";
@@ -136,6 +220,23 @@ extern "C" {
 		return true;
 	}
 
+	uint64_t SDBR_getNumRows(SDBR_HANDLE handle) {
+		using namespace scatdb;
+		uint64_t res = 0;
+		try {
+			auto h = getDB(handle);
+			res = (uint64_t) (h)->floatMat.rows();
+			lastErr="";
+		} catch (std::bad_cast &) {
+			lastErr = "Passed handle in SDBR_writeDB is not a database handle.";
+			return 0;
+		} catch (std::exception &e) {
+			lastErr = std::string(e.what());
+			return 0;
+		}
+		return res;
+	}
+
 	bool SDBR_start(int argc, char** argv) {
 		try {
 			namespace po = boost::program_options;
@@ -192,8 +293,7 @@ extern "C" {
 		using namespace scatdb;
 		uint64_t res = 0;
 		try {
-			const scatdb_base* hp = (const scatdb_base*)(handle);
-			const db* h = dynamic_cast<const db*>(hp);
+			auto h = getDB(handle);
 			uint64_t rows = (uint64_t)(h)->floatMat.rows();
 			uint64_t cols = (uint64_t)(h)->floatMat.cols();
 			*numFloats = rows * cols;
@@ -217,8 +317,7 @@ extern "C" {
 		using namespace scatdb;
 		uint64_t res = 0;
 		try {
-			const scatdb_base* hp = (const scatdb_base*)(handle);
-			const db* h = dynamic_cast<const db*>(hp);
+			auto h = getDB(handle);
 			uint64_t rows = (uint64_t)(h)->intMat.rows();
 			uint64_t cols = (uint64_t)(h)->intMat.cols();
 			*numInts = rows * cols;
@@ -256,13 +355,40 @@ extern "C" {
 		return true;
 	}
 
+	bool DLEXPORT_SDBR SDBR_setFilterThreads(uint64_t numThreads)
+	{
+		using namespace scatdb;
+		filter::setDefaultThreads((size_t)numThreads);
+		lastErr = "";
+		return true;
+	}
+
+	uint64_t DLEXPORT_SDBR SDBR_getFilterThreads()
+	{
+		using namespace scatdb;
+		return (uint64_t)filter::getDefaultThreads();
+	}
+
+	bool DLEXPORT_SDBR SDBR_setQueryCacheBudget(uint64_t bytes)
+	{
+		using namespace scatdb;
+		filter::setCacheBudget(bytes);
+		lastErr = "";
+		return true;
+	}
+
+	uint64_t DLEXPORT_SDBR SDBR_getQueryCacheBudget()
+	{
+		using namespace scatdb;
+		return filter::getCacheBudget();
+	}
+
 	bool DLEXPORT_SDBR SDBR_getFloatTable(SDBR_HANDLE handle, float* p, uint64_t maxsize)
 	{
 		using namespace scatdb;
 		bool res = false;
 		try {
-			const scatdb_base* hp = (const scatdb_base*)(handle);
-			const db* h = dynamic_cast<const db*>(hp);
+			auto h = getDB(handle);
 			uint64_t rows = (uint64_t)(h)->floatMat.rows();
 			uint64_t cols = (uint64_t)(h)->floatMat.cols();
 			uint64_t numFloats = rows * cols;
@@ -291,12 +417,11 @@ extern "C" {
 		using namespace scatdb;
 		bool res = false;
 		try {
-			const scatdb_base* hp = (const scatdb_base*)(handle);
-			const db* h = dynamic_cast<const db*>(hp);
+			auto h = getDB(handle);
 			uint64_t rows = (uint64_t)(h)->intMat.rows();
 			uint64_t cols = (uint64_t)(h)->intMat.cols();
 			uint64_t numInts = rows * cols;
-			uint64_t numBytes = numInts * sizeof(float);
+			uint64_t numBytes = numInts * sizeof(uint64_t);
 			memcpy(p, h->intMat.data(), (maxsize < numBytes) ? maxsize : numBytes);
 			if (maxsize < numBytes) {
 				lastErr = "Destination array is too small.";
@@ -317,14 +442,104 @@ extern "C" {
 		return res;
 	}
 
+	bool DLEXPORT_SDBR SDBR_borrowFloatColumn(SDBR_HANDLE handle,
+		enum data_entries_floats col_id, const float** p, uint64_t* length, uint64_t* stride)
+	{
+		using namespace scatdb;
+		try {
+			auto h = getDB(handle);
+			const int col = (int)col_id;
+			if (col < 0 || col >= db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS) {
+				lastErr = "Column id is out of range.";
+				return false;
+			}
+			// The column store is already built when it is enabled, and its
+			// columns are contiguous. Otherwise, point into floatMat.
+			if (db::useColumnStore()) {
+				auto cols = h->getColumns();
+				*p = cols->floatData(col);
+				*stride = 1;
+			} else {
+				*p = h->floatMat.data() + col;
+				*stride = (uint64_t)h->floatMat.cols();
+			}
+			*length = (uint64_t)h->floatMat.rows();
+			lastErr = "";
+		}
+		catch (std::bad_cast &) {
+			lastErr = "Passed handle in SDBR_borrowFloatColumn is not a database handle.";
+			return false;
+		}
+		catch (std::exception &e) {
+			lastErr = std::string(e.what());
+			return false;
+		}
+		return true;
+	}
+
+	bool DLEXPORT_SDBR SDBR_borrowIntColumn(SDBR_HANDLE handle,
+		enum data_entries_ints col_id, const uint64_t** p, uint64_t* length, uint64_t* stride)
+	{
+		using namespace scatdb;
+		try {
+			auto h = getDB(handle);
+			const int col = (int)col_id;
+			if (col < 0 || col >= db::data_entries::SDBR_NUM_DATA_ENTRIES_INTS) {
+				lastErr = "Column id is out of range.";
+				return false;
+			}
+			// intMat is column-major, so its columns are always contiguous.
+			*p = h->intMat.data() + (col * h->intMat.rows());
+			*length = (uint64_t)h->intMat.rows();
+			*stride = 1;
+			lastErr = "";
+		}
+		catch (std::bad_cast &) {
+			lastErr = "Passed handle in SDBR_borrowIntColumn is not a database handle.";
+			return false;
+		}
+		catch (std::exception &e) {
+			lastErr = std::string(e.what());
+			return false;
+		}
+		return true;
+	}
+
+	bool DLEXPORT_SDBR SDBR_borrowFloatTable(SDBR_HANDLE handle,
+		const float** p, uint64_t* rows, uint64_t* cols)
+	{
+		using namespace scatdb;
+		try {
+			auto h = getDB(handle);
+			*p = h->floatMat.data();
+			*rows = (uint64_t)h->floatMat.rows();
+			*cols = (uint64_t)h->floatMat.cols();
+			lastErr = "";
+		}
+		catch (std::bad_cast &) {
+			lastErr = "Passed handle in SDBR_borrowFloatTable is not a database handle.";
+			return false;
+		}
+		catch (std::exception &e) {
+			lastErr = std::string(e.what());
+			return false;
+		}
+		return true;
+	}
+
 	bool DLEXPORT_SDBR SDBR_getStats(SDBR_HANDLE handle, float *p, uint64_t maxsize, uint64_t *count)
+	{
+		return SDBR_getStatsSelected(handle, ~0ULL, ~0ULL, p, maxsize, count);
+	}
+
+	bool DLEXPORT_SDBR SDBR_getStatsSelected(SDBR_HANDLE handle, uint64_t columnMask,
+		uint64_t statMask, float *p, uint64_t maxsize, uint64_t *count)
 	{
 		using namespace scatdb;
 		bool res = false;
 		try {
-			const scatdb_base* hp = (const scatdb_base*)(handle);
-			const db* h = dynamic_cast<const db*>(hp);
-			auto stats = h->getStats();
+			auto h = getDB(handle);
+			auto stats = h->getStats(db::stats_request(columnMask, statMask));
 			*count = stats->count;
 
 			uint64_t rows = (uint64_t)(stats)->floatStats.rows();
@@ -341,7 +556,7 @@ extern "C" {
 			}
 		}
 		catch (std::bad_cast &) {
-			lastErr = "Passed handle in SDBR_writeDB is not a database handle.";
+			lastErr = "Passed handle in SDBR_getStats is not a database handle.";
 			return false;
 		}
 		catch (std::exception &e) {
@@ -351,13 +566,33 @@ extern "C" {
 		return res;
 	}
 
+	SDBR_HANDLE DLEXPORT_SDBR SDBR_sortByFloat(SDBR_HANDLE handle, data_entries_floats col_id)
+	{
+		using namespace scatdb;
+		try {
+			auto h = getDB(handle);
+			auto sdb_sorted = h->sort((db::data_entries::data_entries_floats) col_id);
+			SDBR_HANDLE res = handles().add(sdb_sorted);
+			lastErr = "";
+			return res;
+		}
+		catch (std::bad_cast &) {
+			lastErr = "Passed handle in SDBR_sortByFloat is not a database handle.";
+			return nullptr;
+		}
+		catch (std::exception &e) {
+			lastErr = std::string(e.what());
+			return nullptr;
+		}
+		return nullptr;
+	}
+
 	SDBR_HANDLE DLEXPORT_SDBR SDBR_filterFloatByString(
 		SDBR_HANDLE handle, data_entries_floats col_id, const char* strFilter)
 	{
 		using namespace scatdb;
 		try {
-			const scatdb_base* hp = (const scatdb_base*)(handle);
-			const db* h = dynamic_cast<const db*>(hp);
+			auto h = getDB(handle);
 			
 			auto f = filter::generate();
 			std::string sstrfilter(strFilter);
@@ -365,9 +600,9 @@ extern "C" {
 			f->addFilterFloat((db::data_entries::data_entries_floats) col_id, sstrfilter);
 			auto sdb_filtered = f->apply(h);
 
-			ptrs[sdb_filtered.get()] = sdb_filtered;
+			SDBR_HANDLE res = handles().add(sdb_filtered);
 			lastErr = "";
-			return (SDBR_HANDLE)(sdb_filtered.get());
+			return res;
 		}
 		catch (std::bad_cast &) {
 			lastErr = "Passed handle in SDBR_writeDB is not a database handle.";
@@ -385,17 +620,16 @@ extern "C" {
 	{
 		using namespace scatdb;
 		try {
-			const scatdb_base* hp = (const scatdb_base*)(handle);
-			const db* h = dynamic_cast<const db*>(hp);
+			auto h = getDB(handle);
 
 			auto f = filter::generate();
 			//f->addFilterInt(db::data_entries::SDBR_FLAKETYPE, vm["flaketypes"].as<string>());
 			f->addFilterFloat((db::data_entries::data_entries_floats) col_id, minVal, maxVal);
 			auto sdb_filtered = f->apply(h);
 
-			ptrs[sdb_filtered.get()] = sdb_filtered;
+			SDBR_HANDLE res = handles().add(sdb_filtered);
 			lastErr = "";
-			return (SDBR_HANDLE)(sdb_filtered.get());
+			return res;
 		}
 		catch (std::bad_cast &) {
 			lastErr = "Passed handle in SDBR_writeDB is not a database handle.";
@@ -413,8 +647,7 @@ extern "C" {
 	{
 		using namespace scatdb;
 		try {
-			const scatdb_base* hp = (const scatdb_base*)(handle);
-			const db* h = dynamic_cast<const db*>(hp);
+			auto h = getDB(handle);
 
 			auto f = filter::generate();
 			std::string sstrfilter(strFilter);
@@ -422,9 +655,9 @@ extern "C" {
 			//f->addFilterFloat((db::data_entries::data_entries_floats) col_id, sstrfilter);
 			auto sdb_filtered = f->apply(h);
 
-			ptrs[sdb_filtered.get()] = sdb_filtered;
+			SDBR_HANDLE res = handles().add(sdb_filtered);
 			lastErr = "";
-			return (SDBR_HANDLE)(sdb_filtered.get());
+			return res;
 		}
 		catch (std::bad_cast &) {
 			lastErr = "Passed handle in SDBR_writeDB is not a database handle.";
@@ -442,17 +675,16 @@ extern "C" {
 	{
 		using namespace scatdb;
 		try {
-			const scatdb_base* hp = (const scatdb_base*)(handle);
-			const db* h = dynamic_cast<const db*>(hp);
+			auto h = getDB(handle);
 
 			auto f = filter::generate();
 			f->addFilterInt((db::data_entries::data_entries_ints) col_id, minVal, maxVal);
 			//f->addFilterFloat((db::data_entries::data_entries_floats) col_id, minVal, maxVal);
 			auto sdb_filtered = f->apply(h);
 
-			ptrs[sdb_filtered.get()] = sdb_filtered;
+			SDBR_HANDLE res = handles().add(sdb_filtered);
 			lastErr = "";
-			return (SDBR_HANDLE)(sdb_filtered.get());
+			return res;
 		}
 		catch (std::bad_cast &) {
 			lastErr = "Passed handle in SDBR_writeDB is not a database handle.";
@@ -465,6 +697,125 @@ extern "C" {
 		return nullptr;
 	}
 
+	uint64_t DLEXPORT_SDBR SDBR_countFloatByString(
+		SDBR_HANDLE handle, data_entries_floats col_id, const char* strFilter)
+	{
+		using namespace scatdb;
+		return countWith(handle, "SDBR_countFloatByString", [&](filter &f) {
+			f.addFilterFloat((db::data_entries::data_entries_floats) col_id, std::string(strFilter)); });
+	}
+
+	uint64_t DLEXPORT_SDBR SDBR_countFloatByRange(
+		SDBR_HANDLE handle, data_entries_floats col_id, float minVal, float maxVal)
+	{
+		using namespace scatdb;
+		return countWith(handle, "SDBR_countFloatByRange", [&](filter &f) {
+			f.addFilterFloat((db::data_entries::data_entries_floats) col_id, minVal, maxVal); });
+	}
+
+	uint64_t DLEXPORT_SDBR SDBR_countIntByString(
+		SDBR_HANDLE handle, data_entries_ints col_id, const char* strFilter)
+	{
+		using namespace scatdb;
+		return countWith(handle, "SDBR_countIntByString", [&](filter &f) {
+			f.addFilterInt((db::data_entries::data_entries_ints) col_id, std::string(strFilter)); });
+	}
+
+	uint64_t DLEXPORT_SDBR SDBR_countIntByRange(
+		SDBR_HANDLE handle, data_entries_ints col_id, uint64_t minVal, uint64_t maxVal)
+	{
+		using namespace scatdb;
+		return countWith(handle, "SDBR_countIntByRange", [&](filter &f) {
+			f.addFilterInt((db::data_entries::data_entries_ints) col_id, minVal, maxVal); });
+	}
+
+	bool DLEXPORT_SDBR SDBR_integratePSD(SDBR_HANDLE handle,
+		float freqMinGHz, float freqMaxGHz, float tempMinK, float tempMaxK,
+		const uint64_t* flaketypes, uint64_t numFlaketypes,
+		const float* binEdgesMM, uint64_t numBins,
+		const float* conc, uint64_t numProfiles,
+		float* backscatter, float* extinction, float* ze)
+	{
+		using namespace scatdb;
+		try {
+			auto h = getDB(handle);
+			if (!binEdgesMM || (numFlaketypes && !flaketypes)) {
+				lastErr = "Passed a NULL array to SDBR_integratePSD.";
+				return false;
+			}
+			auto f = filter::generate();
+			// addFilterFloat excludes its upper bound, and these ranges are inclusive
+			const float inf = std::numeric_limits<float>::infinity();
+			f->addFilterFloat(db::data_entries::SDBR_FREQUENCY_GHZ,
+				freqMinGHz, std::nextafter(freqMaxGHz, inf));
+			f->addFilterFloat(db::data_entries::SDBR_TEMPERATURE_K,
+				tempMinK, std::nextafter(tempMaxK, inf));
+			if (numFlaketypes) {
+				std::ostringstream sfts;
+				for (uint64_t i = 0; i < numFlaketypes; ++i) {
+					if (i) sfts << ",";
+					sfts << flaketypes[i];
+				}
+				f->addFilterInt(db::data_entries::SDBR_FLAKETYPE, sfts.str());
+			}
+			auto v = f->applyView(h);
+			std::vector<float> edges(binEdgesMM, binEdgesMM + numBins + 1);
+			if (!v->numRows()) {
+				// Nothing matched, so every profile integrates to zero. The bin
+				// edges are still checked, as they would be otherwise.
+				db::data_bins::generate(h.get(), db::data_entries::SDBR_MAX_DIMENSION_MM,
+					edges, v->getRows());
+				const size_t n = (size_t)numProfiles;
+				if (backscatter) std::fill(backscatter, backscatter + n, 0.f);
+				if (extinction) std::fill(extinction, extinction + n, 0.f);
+				if (ze) std::fill(ze, ze + n, 0.f);
+				lastErr = "";
+				return true;
+			}
+			auto res = v->integratePSD(edges, conc, (size_t)numProfiles);
+			if (numProfiles) {
+				const size_t bytes = (size_t)numProfiles * sizeof(float);
+				if (backscatter) memcpy(backscatter, res->backscatter.data(), bytes);
+				if (extinction) memcpy(extinction, res->extinction.data(), bytes);
+				if (ze) memcpy(ze, res->ze.data(), bytes);
+			}
+			lastErr = "";
+		}
+		catch (std::bad_cast &) {
+			lastErr = "Passed handle in SDBR_integratePSD is not a database handle.";
+			return false;
+		}
+		catch (std::exception &e) {
+			lastErr = std::string(e.what());
+			return false;
+		}
+		return true;
+	}
+
+	bool DLEXPORT_SDBR SDBR_lookupProperties(SDBR_HANDLE handle,
+		data_entries_floats sizeAxis, uint64_t numPoints,
+		const uint64_t* flaketypes, const float* freqGHz, const float* tempK,
+		const float* sizes, float* out)
+	{
+		using namespace scatdb;
+		try {
+			auto h = getDB(handle);
+			auto lut = h->getLookup((db::data_entries::data_entries_floats) sizeAxis);
+			lut->lookup((size_t)numPoints, flaketypes, freqGHz, tempK, sizes, out,
+				filter::getDefaultThreads());
+			lastErr = "";
+		}
+		catch (std::bad_cast &) {
+			lastErr = "Passed handle in SDBR_lookupProperties is not a database handle.";
+			return false;
+		}
+		catch (std::exception &e) {
+			lastErr = std::string(e.what());
+			return false;
+		}
+		return true;
+	}
+
 	DLEXPORT_SDBR const char* SDBR_stringifyStatsColumn(uint64_t val) {
 		return scatdb::db::data_entries::stringifyStats(val);
 	}
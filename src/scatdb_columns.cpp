@@ -0,0 +1,92 @@
+#include "../scatdb/defs.hpp"
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include "../scatdb/error.hpp"
+#include "../scatdb/scatdb.hpp"
+
+namespace {
+	std::atomic<bool> columnStoreEnabled(false);
+	std::mutex m_columns;
+
+	/// Round a byte count up to the next multiple of the column alignment
+	size_t padBytes(size_t bytes) {
+		const size_t a = scatdb::db::data_columns::alignment;
+		return ((bytes + a - 1) / a) * a;
+	}
+}
+
+namespace scatdb {
+	db::data_columns::data_columns() : rows(0) {
+		for (auto &p : floatPtrs) p = nullptr;
+		for (auto &p : intPtrs) p = nullptr;
+	}
+	db::data_columns::~data_columns() {}
+
+	const float* db::data_columns::floatData(int col) const {
+		if (col < 0 || col >= data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS)
+			SDBR_throw(scatdb::error::error_types::xArrayOutOfBounds)
+			.add<int>("col", col);
+		return floatPtrs[col];
+	}
+
+	const uint64_t* db::data_columns::intData(int col) const {
+		if (col < 0 || col >= data_entries::SDBR_NUM_DATA_ENTRIES_INTS)
+			SDBR_throw(scatdb::error::error_types::xArrayOutOfBounds)
+			.add<int>("col", col);
+		return intPtrs[col];
+	}
+
+	db::data_columns::FloatColType db::data_columns::floatCol(int col) const {
+		return FloatColType(floatData(col), (Eigen::Index)rows);
+	}
+
+	db::data_columns::IntColType db::data_columns::intCol(int col) const {
+		return IntColType(intData(col), (Eigen::Index)rows);
+	}
+
+	std::shared_ptr<const db::data_columns> db::data_columns::generate(const db* src) {
+		std::shared_ptr<db::data_columns> res(new db::data_columns);
+		if (!src) return res;
+		const size_t rows = (size_t)src->floatMat.rows();
+		res->rows = (uint64_t)rows;
+		const size_t floatBytes = padBytes(rows * sizeof(float));
+		const size_t intBytes = padBytes(rows * sizeof(uint64_t));
+		const size_t total = (floatBytes * data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS)
+			+ (intBytes * data_entries::SDBR_NUM_DATA_ENTRIES_INTS) + alignment;
+		res->backing = std::shared_ptr<char>(new char[total], std::default_delete<char[]>());
+
+		// Find the first aligned address in the block
+		char* base = res->backing.get();
+		size_t misalign = (size_t)(reinterpret_cast<uintptr_t>(base) % alignment);
+		if (misalign) base += alignment - misalign;
+
+		// The float columns are transposed out of the row-major floatMat.
+		for (int j = 0; j < data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j) {
+			float* col = reinterpret_cast<float*>(base);
+			for (size_t i = 0; i < rows; ++i)
+				col[i] = src->floatMat((Eigen::Index)i, j);
+			res->floatPtrs[j] = col;
+			base += floatBytes;
+		}
+		// intMat is already column-major, so each column is a single copy.
+		for (int j = 0; j < data_entries::SDBR_NUM_DATA_ENTRIES_INTS; ++j) {
+			uint64_t* col = reinterpret_cast<uint64_t*>(base);
+			if (rows) std::memcpy(col, src->intMat.data() + (j * rows), rows * sizeof(uint64_t));
+			res->intPtrs[j] = col;
+			base += intBytes;
+		}
+		return res;
+	}
+
+	std::shared_ptr<const db::data_columns> db::getColumns() const {
+		std::lock_guard<std::mutex> lock(m_columns);
+		if (!this->pColumns)
+			this->pColumns = db::data_columns::generate(this);
+		return this->pColumns;
+	}
+
+	void db::useColumnStore(bool val) { columnStoreEnabled = val; }
+	bool db::useColumnStore() { return columnStoreEnabled; }
+}
@@ -0,0 +1,85 @@
+#include "../scatdb/defs.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include "../scatdb/error.hpp"
+#include "../scatdb/scatdb.hpp"
+
+namespace {
+	std::atomic<bool> indexesEnabled(false);
+	std::mutex m_index;
+}
+
+namespace scatdb {
+	db::data_index::data_index() : varnum(0) {}
+	db::data_index::~data_index() {}
+
+	std::pair<size_t, size_t> db::data_index::bounds(float lo, float hi) const {
+		if (std::isnan(lo) || std::isnan(hi) || lo > hi)
+			return std::pair<size_t, size_t>(0, 0);
+		auto b = std::lower_bound(values.begin(), values.end(), lo);
+		auto e = std::upper_bound(b, values.end(), hi);
+		return std::pair<size_t, size_t>((size_t)(b - values.begin()), (size_t)(e - values.begin()));
+	}
+
+	uint64_t db::data_index::count(float lo, float hi) const {
+		auto b = bounds(lo, hi);
+		return (uint64_t)(b.second - b.first);
+	}
+
+	void db::data_index::find(float lo, float hi, RowIdsType &out) const {
+		auto b = bounds(lo, hi);
+		out.insert(out.end(), rows.begin() + b.first, rows.begin() + b.second);
+	}
+
+	std::shared_ptr<const db::data_index> db::data_index::generate(const db* src,
+		data_entries::data_entries_floats col) {
+		if ((int)col < 0 || (int)col >= data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS)
+			SDBR_throw(scatdb::error::error_types::xArrayOutOfBounds)
+			.add<int>("col", (int)col);
+		std::shared_ptr<db::data_index> res(new db::data_index);
+		res->varnum = (int)col;
+		if (!src) return res;
+		const size_t numRows = (size_t)src->floatMat.rows();
+		res->rows.reserve(numRows);
+		for (size_t i = 0; i < numRows; ++i)
+			if (!std::isnan(src->floatMat((Eigen::Index)i, col))) res->rows.push_back((uint64_t)i);
+		// Ties are broken by row number so that the ordering is deterministic.
+		std::sort(res->rows.begin(), res->rows.end(), [&](uint64_t a, uint64_t b) -> bool {
+			const float va = src->floatMat((Eigen::Index)a, col);
+			const float vb = src->floatMat((Eigen::Index)b, col);
+			return (va < vb) || (va == vb && a < b);
+		});
+		res->values.resize(res->rows.size());
+		for (size_t i = 0; i < res->rows.size(); ++i)
+			res->values[i] = src->floatMat((Eigen::Index)res->rows[i], col);
+		return res;
+	}
+
+	std::shared_ptr<const db::data_index> db::getIndex(data_entries::data_entries_floats col) const {
+		if ((int)col < 0 || (int)col >= data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS)
+			SDBR_throw(scatdb::error::error_types::xArrayOutOfBounds)
+			.add<int>("col", (int)col);
+		std::lock_guard<std::mutex> lock(m_index);
+		if (!this->pIndices[col])
+			this->pIndices[col] = db::data_index::generate(this, col);
+		return this->pIndices[col];
+	}
+
+	void db::useIndexes(bool val) { indexesEnabled = val; }
+	bool db::useIndexes() { return indexesEnabled; }
+
+	bool db::isIndexed(data_entries::data_entries_floats col) {
+		switch (col) {
+		case data_entries::SDBR_FREQUENCY_GHZ:
+		case data_entries::SDBR_TEMPERATURE_K:
+		case data_entries::SDBR_AEFF_UM:
+		case data_entries::SDBR_MAX_DIMENSION_MM:
+			return true;
+		default:
+			return false;
+		}
+	}
+}
@@ -76,6 +76,7 @@
  *      1000	- 	can not find suitable ice shape		      *
  *      	        No valid return values			      *
  *      2000    -       cannot find scat_db2.dda file                  *
+ *      3000    -       scat_db2.dda is truncated or malformed         *
  *								      *
  * In&Out:							      *
  *  is_loaded - indicator whether dda_database is loaded to memory,   *
@@ -102,6 +103,7 @@
 #include "../scatdb/defs.h"
 #include "../scatdb/scatdb_liu.h"
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
@@ -156,65 +158,100 @@ extern "C" {
 			;
 	}
 
-	int liu_scatdb(float f, float t, int nshape, float dmax, float *cabs, float *csca, float *cbsc, float *g, float *p, float *re, int *is_loaded) {
-		FILE *fp;
-		static float fs[NFREQ], ts[NTEMP], szs[NSIZE][NSHAP], abss[NFREQ][NTEMP][NSHAP][NSIZE], scas[NFREQ][NTEMP][NSHAP][NSIZE],
-			bscs[NFREQ][NTEMP][NSHAP][NSIZE], gs[NFREQ][NTEMP][NSHAP][NSIZE], reff[NSIZE][NSHAP], pqs[NFREQ][NTEMP][NSHAP][NSIZE][NQ];
-		static int shs[NSHAP], mf, mt, msh, msz[NSHAP];
-		int iret = 0, it1 = -1, it2 = -1, if1 = -1, if2 = -1, ir1 = -1, ir2 = -1, big = TRUE;
-		float x1, x2, y1, y2, a1, b1, c1, d1;
-		int i, j, k, m, n;
-		//char *db_dir, wk[180];
-		if (*is_loaded != TRUE) {
-			if (!(fp = fopen(_get_scatdb_location(), "rb"))) {
-				fprintf(stderr, "Cannot find scat_db2.dda file.\n");
-				return(iret = 2000);
-			}
+	/* Byte-swap n 32-bit words in place. Written as shifts and masks so
+	   that compilers turn it into vector shuffles. */
+	static void reverse_words(uint32_t *w, size_t n) {
+		size_t i;
+		for (i = 0; i < n; i++) {
+			uint32_t x = w[i];
+			w[i] = (x >> 24) | ((x >> 8) & 0x0000ff00u) | ((x << 8) & 0x00ff0000u) | (x << 24);
+		}
+	}
 
-			if (little_endian() == TRUE) big = FALSE;
-
-			fread(&msh, 4, 1, fp);
-			if (big) reverse(&msh, 4);
-			fread(&mf, 4, 1, fp);
-			if (big) reverse(&mf, 4);
-			fread(&mt, 4, 1, fp);
-			if (big) reverse(&mt, 4);
-
-			for (i = 0; i < msh; i++) {
-				fread(&shs[i], 4, 1, fp);
-				if (big) reverse(&shs[i], 4);
-				fread(&msz[i], 4, 1, fp);
-				if (big) reverse(&msz[i], 4);
-				for (j = 0; j < msz[i]; j++) {
-					fread(&szs[j][shs[i]], 4, 1, fp);
-					if (big) reverse(&szs[j][shs[i]], 4);
-					fread(&reff[j][shs[i]], 4, 1, fp);
-					if (big) reverse(&reff[j][shs[i]], 4);
-					for (m = 0; m < mf; m++) {
-						fread(&fs[m], 4, 1, fp);
-						if (big) reverse(&fs[m], 4);
-						for (n = 0; n < mt; n++) {
-							fread(&ts[n], 4, 1, fp);
-							if (big) reverse(&ts[n], 4);
-							fread(&abss[m][n][shs[i]][j], 4, 1, fp);
-							if (big) reverse(&abss[m][n][shs[i]][j], 4);
-							fread(&scas[m][n][shs[i]][j], 4, 1, fp);
-							if (big) reverse(&scas[m][n][shs[i]][j], 4);
-							fread(&bscs[m][n][shs[i]][j], 4, 1, fp);
-							if (big) reverse(&bscs[m][n][shs[i]][j], 4);
-							fread(&gs[m][n][shs[i]][j], 4, 1, fp);
-							if (big) reverse(&gs[m][n][shs[i]][j], 4);
-							for (k = 0; k < NQ; k++) {
-								fread(&pqs[m][n][shs[i]][j][k], 4, 1, fp);
-								if (big) reverse(&pqs[m][n][shs[i]][j][k], 4);
-							}
-						}
+	int liu_scatdb_readtables(const char* filename, struct liu_scatdb_tables* out) {
+		/* The whole file is read with a single fread and byte-swapped in one
+		   pass (the file is little-endian). The records are then copied out
+		   of the buffer. Every int and float in the file is 4 bytes. */
+		FILE *fp;
+		long len;
+		size_t nwords, pos = 0;
+		uint32_t *buf;
+		int i, j, m, n, s;
+		if (!filename || !(fp = fopen(filename, "rb"))) {
+			fprintf(stderr, "Cannot find scat_db2.dda file.\n");
+			return 2000;
+		}
+		fseek(fp, 0, SEEK_END);
+		len = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		if (len < 12) { fclose(fp); return 3000; }
+		nwords = (size_t)len / 4;
+		buf = (uint32_t*)malloc(nwords * 4);
+		if (!buf) { fclose(fp); return 2000; }
+		if (fread(buf, 4, nwords, fp) != nwords) { free(buf); fclose(fp); return 2000; }
+		fclose(fp);
+		if (little_endian() == FALSE) reverse_words(buf, nwords);
+
+#define LIU_NEED(count) if (pos + (size_t)(count) > nwords) { free(buf); return 3000; }
+#define LIU_INT(dst) { int32_t v_; memcpy(&v_, buf + pos, 4); (dst) = (int)v_; pos++; }
+#define LIU_FLOATS(dst, count) { memcpy((dst), buf + pos, 4 * (size_t)(count)); pos += (size_t)(count); }
+		LIU_NEED(3);
+		LIU_INT(out->msh);
+		LIU_INT(out->mf);
+		LIU_INT(out->mt);
+		if (out->msh < 0 || out->msh > NSHAP || out->mf < 0 || out->mf > NFREQ
+			|| out->mt < 0 || out->mt > NTEMP) { free(buf); return 3000; }
+
+		for (i = 0; i < out->msh; i++) {
+			LIU_NEED(2);
+			LIU_INT(out->shs[i]);
+			LIU_INT(out->msz[i]);
+			s = out->shs[i];
+			if (s < 0 || s >= NSHAP || out->msz[i] < 0 || out->msz[i] > NSIZE) { free(buf); return 3000; }
+			/* Each size holds its dimensions, then per frequency the frequency and
+			   per temperature the temperature, four cross sections and NQ angles. */
+			LIU_NEED((size_t)out->msz[i] * (2 + (size_t)out->mf * (1 + (size_t)out->mt * (5 + NQ))));
+			for (j = 0; j < out->msz[i]; j++) {
+				LIU_FLOATS(&out->szs[j][s], 1);
+				LIU_FLOATS(&out->reff[j][s], 1);
+				for (m = 0; m < out->mf; m++) {
+					LIU_FLOATS(&out->fs[m], 1);
+					for (n = 0; n < out->mt; n++) {
+						LIU_FLOATS(&out->ts[n], 1);
+						LIU_FLOATS(&out->abss[m][n][s][j], 1);
+						LIU_FLOATS(&out->scas[m][n][s][j], 1);
+						LIU_FLOATS(&out->bscs[m][n][s][j], 1);
+						LIU_FLOATS(&out->gs[m][n][s][j], 1);
+						LIU_FLOATS(out->pqs[m][n][s][j], NQ);
 					}
 				}
 			}
-			fclose(fp);
+		}
+#undef LIU_NEED
+#undef LIU_INT
+#undef LIU_FLOATS
+		free(buf);
+		return 0;
+	}
+
+	int liu_scatdb(float f, float t, int nshape, float dmax, float *cabs, float *csca, float *cbsc, float *g, float *p, float *re, int *is_loaded) {
+		static struct liu_scatdb_tables tab;
+		int iret = 0, it1 = -1, it2 = -1, if1 = -1, if2 = -1, ir1 = -1, ir2 = -1;
+		float x1, x2, y1, y2, a1, b1, c1, d1;
+		int i;
+		int mf, mt, msh;
+		const float *fs = tab.fs, *ts = tab.ts;
+		float (*szs)[NSHAP] = tab.szs, (*reff)[NSHAP] = tab.reff;
+		float (*abss)[NTEMP][NSHAP][NSIZE] = tab.abss, (*scas)[NTEMP][NSHAP][NSIZE] = tab.scas,
+			(*bscs)[NTEMP][NSHAP][NSIZE] = tab.bscs, (*gs)[NTEMP][NSHAP][NSIZE] = tab.gs;
+		float (*pqs)[NTEMP][NSHAP][NSIZE][NQ] = tab.pqs;
+		const int *msz = tab.msz;
+		if (*is_loaded != TRUE) {
+			iret = liu_scatdb_readtables(_get_scatdb_location(), &tab);
+			if (iret) return iret;
 			*is_loaded = TRUE;
 		}
+		mf = tab.mf; mt = tab.mt; msh = tab.msh;
 
 		if ((nshape < 0) || (nshape > msh - 1)) return(iret = 1000);
 
@@ -357,88 +394,30 @@ extern "C" {
 		float *o_bscs, float* o_gs, float* o_reff, float* o_pqs,
 		int* o_shs, int* o_msz, int* o_mf, int* o_mt, int* o_msh)
 	{
-		FILE *fp;
-		static float fs[NFREQ], ts[NTEMP], szs[NSIZE][NSHAP], abss[NFREQ][NTEMP][NSHAP][NSIZE],
-			scas[NFREQ][NTEMP][NSHAP][NSIZE],
-			bscs[NFREQ][NTEMP][NSHAP][NSIZE], gs[NFREQ][NTEMP][NSHAP][NSIZE],
-			reff[NSIZE][NSHAP], pqs[NFREQ][NTEMP][NSHAP][NSIZE][NQ];
-		static int shs[NSHAP], mf, mt, msh, msz[NSHAP];
-		int iret = 0, it1 = -1, it2 = -1, if1 = -1, if2 = -1, ir1 = -1, ir2 = -1, big = TRUE;
-		//float x1, x2, y1, y2, a1, b1, c1, d1;
-		int i, j, k, m, n;
-		//char *db_dir, wk[180];
-		if (!(fp = fopen(_get_scatdb_location(), "rb"))) {
-			fprintf(stderr, "Cannot find scat_db2.dda file.\n");
-			return(iret = 2000);
-		}
-
-		if (little_endian() == TRUE) big = FALSE;
-
-		fread(&msh, 4, 1, fp);
-		if (big) reverse(&msh, 4);
-		fread(&mf, 4, 1, fp);
-		if (big) reverse(&mf, 4);
-		fread(&mt, 4, 1, fp);
-		if (big) reverse(&mt, 4);
-
-		for (i = 0; i < msh; i++) {
-			fread(&shs[i], 4, 1, fp);
-			if (big) reverse(&shs[i], 4);
-			fread(&msz[i], 4, 1, fp);
-			if (big) reverse(&msz[i], 4);
-			for (j = 0; j < msz[i]; j++) {
-				fread(&szs[j][shs[i]], 4, 1, fp);
-				if (big) reverse(&szs[j][shs[i]], 4);
-				fread(&reff[j][shs[i]], 4, 1, fp);
-				if (big) reverse(&reff[j][shs[i]], 4);
-				for (m = 0; m < mf; m++) {
-					fread(&fs[m], 4, 1, fp);
-					if (big) reverse(&fs[m], 4);
-					for (n = 0; n < mt; n++) {
-						fread(&ts[n], 4, 1, fp);
-						if (big) reverse(&ts[n], 4);
-						fread(&abss[m][n][shs[i]][j], 4, 1, fp);
-						if (big) reverse(&abss[m][n][shs[i]][j], 4);
-						fread(&scas[m][n][shs[i]][j], 4, 1, fp);
-						if (big) reverse(&scas[m][n][shs[i]][j], 4);
-						fread(&bscs[m][n][shs[i]][j], 4, 1, fp);
-						if (big) reverse(&bscs[m][n][shs[i]][j], 4);
-						fread(&gs[m][n][shs[i]][j], 4, 1, fp);
-						if (big) reverse(&gs[m][n][shs[i]][j], 4);
-						for (k = 0; k < NQ; k++) {
-							fread(&pqs[m][n][shs[i]][j][k], 4, 1, fp);
-							if (big) reverse(&pqs[m][n][shs[i]][j][k], 4);
-						}
-					}
-				}
-			}
-		}
-		fclose(fp);
-
-		//static float fs[NFREQ], ts[NTEMP], szs[NSIZE][NSHAP], abss[NFREQ][NTEMP][NSHAP][NSIZE],
-		//	scas[NFREQ][NTEMP][NSHAP][NSIZE],
-		//	bscs[NFREQ][NTEMP][NSHAP][NSIZE], gs[NFREQ][NTEMP][NSHAP][NSIZE],
-		//	reff[NSIZE][NSHAP], pqs[NFREQ][NTEMP][NSHAP][NSIZE][NQ];
-		//static int shs[NSHAP], mf, mt, msh, msz[NSHAP];
-		memcpy_s(o_fs, NFREQ * sizeof(float), fs, NFREQ * sizeof(float));
-		memcpy_s(o_ts, NTEMP * sizeof(float), ts, NTEMP * sizeof(float));
-		memcpy_s(o_szs, NSIZE*NSHAP * sizeof(float), szs, NSIZE*NSHAP * sizeof(float));
-		memcpy_s(o_abss, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float), abss, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float));
-		memcpy_s(o_scas, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float), scas, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float));
-		memcpy_s(o_bscs, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float), bscs, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float));
-		memcpy_s(o_gs, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float), gs, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float));
-		memcpy_s(o_reff, NSHAP*NSIZE * sizeof(float), reff, NSHAP*NSIZE * sizeof(float));
-		memcpy_s(o_pqs, NFREQ*NTEMP*NSHAP*NSIZE*NQ * sizeof(float), pqs, NFREQ*NTEMP*NSHAP*NSIZE*NQ * sizeof(float));
-		memcpy_s(o_shs, NSHAP * sizeof(float), shs, NSHAP * sizeof(float));
-		memcpy_s(o_msz, NSHAP * sizeof(float), msz, NSHAP * sizeof(float));
-		//float* o_mf, float* o_mt, float* o_msh
-		*o_mf = mf;
-		*o_mt = mt;
-		*o_msh = msh;
+		struct liu_scatdb_tables *tab = (struct liu_scatdb_tables*)calloc(1, sizeof(struct liu_scatdb_tables));
+		int iret;
+		if (!tab) return 2000;
+		iret = liu_scatdb_readtables(_get_scatdb_location(), tab);
+		if (iret) { free(tab); return iret; }
+
+		memcpy_s(o_fs, NFREQ * sizeof(float), tab->fs, NFREQ * sizeof(float));
+		memcpy_s(o_ts, NTEMP * sizeof(float), tab->ts, NTEMP * sizeof(float));
+		memcpy_s(o_szs, NSIZE*NSHAP * sizeof(float), tab->szs, NSIZE*NSHAP * sizeof(float));
+		memcpy_s(o_abss, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float), tab->abss, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float));
+		memcpy_s(o_scas, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float), tab->scas, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float));
+		memcpy_s(o_bscs, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float), tab->bscs, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float));
+		memcpy_s(o_gs, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float), tab->gs, NFREQ*NTEMP*NSHAP*NSIZE * sizeof(float));
+		memcpy_s(o_reff, NSHAP*NSIZE * sizeof(float), tab->reff, NSHAP*NSIZE * sizeof(float));
+		memcpy_s(o_pqs, NFREQ*NTEMP*NSHAP*NSIZE*NQ * sizeof(float), tab->pqs, NFREQ*NTEMP*NSHAP*NSIZE*NQ * sizeof(float));
+		memcpy_s(o_shs, NSHAP * sizeof(int), tab->shs, NSHAP * sizeof(int));
+		memcpy_s(o_msz, NSHAP * sizeof(int), tab->msz, NSHAP * sizeof(int));
+		*o_mf = tab->mf;
+		*o_mt = tab->mt;
+		*o_msh = tab->msh;
+		free(tab);
 		return iret;
 	}
 
 #ifdef __cplusplus
 };
 #endif
-
@@ -5,17 +5,38 @@
 #include "../private/info.hpp"
 #include "../scatdb/error.hpp"
 #include <boost/filesystem.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 
 namespace scatdb {
 	namespace scatdb_liu {
-		std::string sdb_loc;
+		namespace {
+			/// Guards locations and every change to sdb_loc
+			std::mutex m_loc;
+			/// Every location that has been set or found. Entries are never
+			/// removed, so the strings (and their c_str()) stay valid.
+			std::set<std::string> locations;
+			/// The current location, or nullptr if none is known yet
+			std::atomic<const std::string*> sdb_loc(nullptr);
+		}
 		void set_scatdb_location(const char* p) {
 			if (!p) SDBR_throw(scatdb::error::error_types::xNullPointer);
-			sdb_loc = std::string(p);
+			std::lock_guard<std::mutex> lock(m_loc);
+			sdb_loc = &*(locations.insert(std::string(p)).first);
 		}
-		const char* get_scatdb_location() {
-			if (sdb_loc.size()) return sdb_loc.c_str();
+		/// The current location, searching for scat_db2.dda if none is set
+		const std::string* find_scatdb_location() {
+			const std::string* cur = sdb_loc.load();
+			if (cur) return cur;
+			std::lock_guard<std::mutex> lock(m_loc);
+			if (sdb_loc.load()) return sdb_loc.load();
 
 			const std::string envVar("SCATDB_DATA");
 			
@@ -26,129 +47,146 @@ namespace scatdb {
 				const path defaultFileName("scat_db2.dda");
 				path ppf = pp / defaultFileName;
 				if (exists(ppf)) {
-					sdb_loc = ppf.string();
+					sdb_loc = &*(locations.insert(ppf.string()).first);
 					return true;
 				}
 				return false;
 			};
 
-			bool res = false;
 			auto m = scatdb::debug::getCurrentAppInfo();
 			const auto &mEnv = m->pInfo->expandedEnviron;
 			if (mEnv.count(envVar)) {
-				if (search(mEnv.at(envVar))) return sdb_loc.c_str();
+				if (search(mEnv.at(envVar))) return sdb_loc.load();
 			}
-			if (search(m->pInfo->cwd)) return sdb_loc.c_str();
-			if (search(m->pInfo->path)) return sdb_loc.c_str();
-			if (search(m->appConfigDir)) return sdb_loc.c_str();
+			if (search(m->pInfo->cwd)) return sdb_loc.load();
+			if (search(m->pInfo->path)) return sdb_loc.load();
+			if (search(m->appConfigDir)) return sdb_loc.load();
 
 			SDBR_throw(scatdb::error::error_types::xMissingFile)
 				.add<std::string>("Reason", "Cannot find scat_db2.dda. "
 					"Please set the SCATDB_DATA environment variable to point "
 					"to its containing folder.");
-			return sdb_loc.c_str(); // Vestigial, but avoids compiler warning
+			return nullptr; // Vestigial, but avoids compiler warning
+		}
+		const char* get_scatdb_location() {
+			return find_scatdb_location()->c_str();
+		}
+	}
+
+	namespace scatdb_liu {
+		namespace {
+			/// Tables read for liu_scatdb_batch, and the location they came from
+			struct loadedTables {
+				const std::string* from;
+				std::unique_ptr<liu_scatdb_tables> tab;
+			};
+			/// Guards allTables
+			std::mutex m_tables;
+			/// Every table set that has been read. They are kept for the life
+			/// of the process, so that a published pointer never dangles.
+			std::list<loadedTables> allTables;
+			/// The tables for the most recently used location
+			std::atomic<const loadedTables*> batchTables(nullptr);
+
+			/// Get the tables for liu_scatdb_batch, reading them once per file
+			/// location. Once loaded, this takes no lock. Returns a liu_scatdb
+			/// error code.
+			int getTables(const liu_scatdb_tables* &out) {
+				const std::string* loc = nullptr;
+				try { loc = find_scatdb_location(); }
+				catch (std::exception &) { return 2000; }
+				const loadedTables* cur = batchTables.load(std::memory_order_acquire);
+				if (cur && cur->from == loc) {
+					out = cur->tab.get();
+					return 0;
+				}
+				std::lock_guard<std::mutex> lock(m_tables);
+				auto it = std::find_if(allTables.begin(), allTables.end(),
+					[&](const loadedTables &t) { return t.from == loc; });
+				if (it == allTables.end()) {
+					loadedTables t;
+					t.from = loc;
+					t.tab.reset(new liu_scatdb_tables());
+					int retval = liu_scatdb_readtables(loc->c_str(), t.tab.get());
+					if (retval) return retval;
+					allTables.push_back(std::move(t));
+					it = std::prev(allTables.end());
+				}
+				batchTables.store(&*it, std::memory_order_release);
+				out = it->tab.get();
+				return 0;
+			}
+
+			/// Find i such that x lies between v[i] and v[i+1], for m >= 2 values
+			/// in ascending (or, with descending set, descending) order. Values
+			/// outside of the table use the end intervals, and add lowCode or
+			/// highCode to iret, as in liu_scatdb.
+			int bracket(const float* v, int m, float x, bool descending,
+				int lowCode, int highCode, int &iret) {
+				const float lo = (descending) ? v[m - 1] : v[0];
+				const float hi = (descending) ? v[0] : v[m - 1];
+				if (!(x >= lo && x <= hi)) {
+					// NaN goes to the same side as in liu_scatdb's linear search
+					const bool below = (descending) ? !(x > hi) : (x < lo);
+					iret += (below) ? lowCode : highCode;
+					return (below != descending) ? 0 : m - 2;
+				}
+				const float* k = (descending)
+					? std::lower_bound(v + 1, v + m, x, [](float a, float b) { return a > b; })
+					: std::lower_bound(v + 1, v + m, x);
+				return (int)(k - v) - 1;
+			}
 		}
 	}
 
 	void db::readDBscatdb(std::shared_ptr<db> res, const char* dbfile) {
-		if (dbfile) _set_scatdb_location(dbfile);
-		/*
-		static float fs[NFREQ], ts[NTEMP], szs[NSIZE][NSHAP], abss[NFREQ][NTEMP][NSHAP][NSIZE],
-		scas[NFREQ][NTEMP][NSHAP][NSIZE],
-		bscs[NFREQ][NTEMP][NSHAP][NSIZE], gs[NFREQ][NTEMP][NSHAP][NSIZE],
-		reff[NSIZE][NSHAP], pqs[NFREQ][NTEMP][NSHAP][NSIZE][NQ];
-		static int shs[NSHAP], mf, mt, msh, msz[NSHAP];
-		*/
-		std::unique_ptr<float[]>
-			o_fs(new float[NFREQ]),
-			o_ts(new float[NTEMP]),
-			o_szs(new float[NSIZE*NSHAP]),
-			o_abss(new float[NFREQ*NTEMP*NSHAP*NSIZE]),
-			o_scas(new float[NFREQ*NTEMP*NSHAP*NSIZE]),
-			o_bscs(new float[NFREQ*NTEMP*NSHAP*NSIZE]),
-			o_gs(new float[NFREQ*NTEMP*NSHAP*NSIZE]),
-			o_reff(new float[NSIZE*NSHAP]),
-			o_pqs(new float[NFREQ*NTEMP*NSHAP*NSIZE*NQ]);
-		std::unique_ptr<int[]>
-			o_shs(new int[NSHAP]),
-			o_msz(new int[NSHAP]);
-		for (int i = 0; i < NFREQ; ++i) o_fs.get()[i] = -1;
-		int o_mf = 0, o_mt = 0, o_msh = 0;
-		int retval = liu_scatdb_onlyread(
-			o_fs.get(), o_ts.get(), o_szs.get(), o_abss.get(), o_scas.get(),
-			o_bscs.get(), o_gs.get(), o_reff.get(), o_pqs.get(),
-			o_shs.get(), o_msz.get(), &o_mf, &o_mt, &o_msh);
+		// The file is read from its own path, and not through the process-wide
+		// location used by liu_scatdb, since loadDB may read several .dda
+		// files at once.
+		const std::string loc = (dbfile) ? std::string(dbfile)
+			: std::string(_get_scatdb_location());
+		// The tables are several megabytes, so they go on the heap. They
+		// start zeroed, which marks unused slots as invalid below.
+		std::unique_ptr<liu_scatdb_tables> tab(new liu_scatdb_tables());
+		int retval = liu_scatdb_readtables(loc.c_str(), tab.get());
+		if (retval) SDBR_throw(scatdb::error::error_types::xBadFunctionReturn)
+			.add<std::string>("Reason", "Cannot read scat_db2.dda.")
+			.add<std::string>("filename", loc)
+			.add<int>("retval", retval);
 
-		// Now, decompose into database entries
-		// There are NFREQ*NTEMP*NSHAP*NSIZE entries
-		auto getIndex4 = [](int f, int t, int s, int z) -> int {
-			int res = f; res *= NTEMP;
-			res += t; res *= NSHAP;
-			res += s; res *= NSIZE;
-			res += z; return res;
-		};
-		auto getIndexSizeShape = [](int size, int shape) -> int {
-			int res = size; res *= NSHAP; res += shape; return res;
-		};
-		int numFreqs = NFREQ, numTemps = NTEMP, numShapes = NSHAP, numSizes = NSIZE;
-		int n4 = NFREQ*NTEMP*NSHAP*NSIZE;
-		/*
-		for (int i = 0; i < numShapes; ++i) std::cout << " " << *(o_shs.get() + i);
-		std::cout << std::endl;
-		for (int i = 0; i < numShapes; ++i) std::cout << " " << *(o_msz.get() + i);
-		std::cout << std::endl;
-		for (int i = 0; i < numFreqs; ++i) std::cout << " " << *(o_fs.get() + i);
-		std::cout << std::endl;
-		for (int i = 0; i < numTemps; ++i) std::cout << " " << *(o_ts.get() + i);
-		std::cout << std::endl;
-		std::cout << "numFreqs = " << numFreqs << " numTemps = " << numTemps
-			<< " numShapes " << numShapes << " numSizes " << numSizes << std::endl;
-		*/
-		res->floatMat.resize(NFREQ*NTEMP*NSHAP*NSIZE,data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS);
-		res->intMat.resize(NFREQ*NTEMP*NSHAP*NSIZE, data_entries::SDBR_NUM_DATA_ENTRIES_INTS);
-		res->floatMat.setConstant(-1);
-		res->intMat.setConstant(-1);
-		int i = 0, line = -1;
-		for (int ifreq = 0; ifreq < numFreqs; ++ifreq) {
-			for (int itemp = 0; itemp < numTemps; ++itemp) {
-				for (int ishape = 0; ishape < numShapes; ++ishape) {
-					for (int isize = 0; isize < numSizes; ++isize) {
-						line++;
-						int idx4 = getIndex4(ifreq, itemp, ishape, isize);
-						int idxss = getIndexSizeShape(isize, ishape);
-						// &fts, &its
+		// Now, decompose into database entries. There are at most
+		// NFREQ*NTEMP*NSHAP*NSIZE of them, in frequency, temperature, shape
+		// and size order.
+		const int maxRows = NFREQ*NTEMP*NSHAP*NSIZE;
+		res->floatMat.resize(maxRows, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS);
+		res->intMat.resize(maxRows, data_entries::SDBR_NUM_DATA_ENTRIES_INTS);
+		res->phaseMat.resize(maxRows, NQ);
+		int i = 0;
+		for (int ifreq = 0; ifreq < tab->mf; ++ifreq) {
+			for (int itemp = 0; itemp < tab->mt; ++itemp) {
+				for (int ishape = 0; ishape < tab->msh; ++ishape) {
+					const int s = tab->shs[ishape];
+					for (int isize = 0; isize < tab->msz[ishape]; ++isize) {
 						auto fts = res->floatMat.block<1, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS>(i, 0);
 						auto its = res->intMat.block<1, data_entries::SDBR_NUM_DATA_ENTRIES_INTS>(i, 0);
-						bool invalid = false;
-						its(data_entries::SDBR_FLAKETYPE) = o_shs.get()[ishape];
-						// its(...) is an unsigned int. Check cannot succeed.
-						if (its(data_entries::SDBR_FLAKETYPE) > 1000) invalid = true;
-						fts(data_entries::SDBR_FREQUENCY_GHZ) = o_fs.get()[ifreq];
-						if (fts(data_entries::SDBR_FREQUENCY_GHZ) <= 0) invalid = true;
-						fts(data_entries::SDBR_TEMPERATURE_K) = o_ts.get()[itemp];
-						if (fts(data_entries::SDBR_TEMPERATURE_K) <= 0) invalid = true;
-						fts(data_entries::SDBR_AEFF_UM) = o_reff.get()[idxss];
-						if (fts(data_entries::SDBR_AEFF_UM) <= 0) invalid = true;
-						fts(data_entries::SDBR_MAX_DIMENSION_MM) = o_szs.get()[idxss] / 1000;
-						if (fts(data_entries::SDBR_MAX_DIMENSION_MM) <= 0) invalid = true;
-						fts(data_entries::SDBR_CABS_M) = o_abss.get()[idx4];
-						if (fts(data_entries::SDBR_CABS_M) <= 0) invalid = true;
-						fts(data_entries::SDBR_CBK_M) = o_bscs.get()[idx4];
-						fts(data_entries::SDBR_CSCA_M) = o_scas.get()[idx4];
+						its(data_entries::SDBR_FLAKETYPE) = (uint64_t)s;
+						fts(data_entries::SDBR_FREQUENCY_GHZ) = tab->fs[ifreq];
+						fts(data_entries::SDBR_TEMPERATURE_K) = tab->ts[itemp];
+						fts(data_entries::SDBR_AEFF_UM) = tab->reff[isize][s];
+						fts(data_entries::SDBR_MAX_DIMENSION_MM) = tab->szs[isize][s] / 1000;
+						fts(data_entries::SDBR_CABS_M) = tab->abss[ifreq][itemp][s][isize];
+						fts(data_entries::SDBR_CBK_M) = tab->bscs[ifreq][itemp][s][isize];
+						fts(data_entries::SDBR_CSCA_M) = tab->scas[ifreq][itemp][s][isize];
 						fts(data_entries::SDBR_CEXT_M) = fts(data_entries::SDBR_CSCA_M) + fts(data_entries::SDBR_CABS_M);
-						fts(data_entries::SDBR_G) = o_gs.get()[idx4];
+						fts(data_entries::SDBR_G) = tab->gs[ifreq][itemp][s][isize];
 						fts(data_entries::SDBR_AS_XY) = -1;
-						/*
-						std::cout << "i = " << i << " line = " << line
-							<< " idx4 " << idx4 << " idxss " << idxss
-							<< "   ifreq " << ifreq << " itemp " << itemp << " ishape " << ishape
-							<< " isize " << isize << std::endl
-							<< its(data_entries::SDBR_FLAKETYPE) << "  "
-							<< fts << std::endl;
-						*/
-						if (invalid) {
-							continue;
-						}
+						const bool invalid = (fts(data_entries::SDBR_FREQUENCY_GHZ) <= 0)
+							|| (fts(data_entries::SDBR_TEMPERATURE_K) <= 0)
+							|| (fts(data_entries::SDBR_AEFF_UM) <= 0)
+							|| (fts(data_entries::SDBR_MAX_DIMENSION_MM) <= 0)
+							|| (fts(data_entries::SDBR_CABS_M) <= 0);
+						if (invalid) continue;
+						std::memcpy(res->phaseMat.row(i).data(), tab->pqs[ifreq][itemp][s][isize], NQ * sizeof(float));
 						++i;
 					}
 				}
@@ -156,6 +194,7 @@ namespace scatdb {
 		}
 		res->floatMat.conservativeResize(i, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS);
 		res->intMat.conservativeResize(i, data_entries::SDBR_NUM_DATA_ENTRIES_INTS);
+		res->phaseMat.conservativeResize(i, NQ);
 	}
 }
 #ifdef __cplusplus
@@ -167,6 +206,61 @@ extern "C" {
 	void _set_scatdb_location(const char* loc) {
 		return scatdb::scatdb_liu::set_scatdb_location(loc);
 	}
+
+	int liu_scatdb_batch(int n, const float* f, const float* t, const int* nshape,
+		const float* dmax, float* cabs, float* csca, float* cbsc, float* g, float* p,
+		float* re, int* iret) {
+		using namespace scatdb::scatdb_liu;
+		const liu_scatdb_tables* tab = nullptr;
+		int retval = getTables(tab);
+		if (retval) return retval;
+		const liu_scatdb_tables &d = *tab;
+
+		for (int q = 0; q < n; ++q) {
+			const int s = nshape[q];
+			int code = 0;
+			if (s < 0 || s > d.msh - 1 || d.mf < 2 || d.mt < 2 || d.msz[s] < 2) {
+				if (iret) iret[q] = 1000;
+				continue;
+			}
+			// Brackets and weights along each axis. Temperatures are stored
+			// from warmest to coldest.
+			const int if1 = bracket(d.fs, d.mf, f[q], false, 2, 1, code);
+			const int it1 = bracket(d.ts, d.mt, t[q], true, 20, 10, code);
+			float szs[NSIZE];
+			for (int j = 0; j < d.msz[s]; ++j) szs[j] = d.szs[j][s];
+			const int ir1 = bracket(szs, d.msz[s], dmax[q], false, 200, 100, code);
+			const float wf = (f[q] - d.fs[if1]) / (d.fs[if1 + 1] - d.fs[if1]);
+			const float wt = (t[q] - d.ts[it1]) / (d.ts[it1 + 1] - d.ts[it1]);
+			const float wr = (dmax[q] - szs[ir1]) / (szs[ir1 + 1] - szs[ir1]);
+			// The eight corner weights, ordered as (frequency, temperature, size) bits
+			float w[8];
+			for (int c = 0; c < 8; ++c)
+				w[c] = ((c & 4) ? wf : 1.f - wf) * ((c & 2) ? wt : 1.f - wt) * ((c & 1) ? wr : 1.f - wr);
+			auto blend = [&](const float (*v)[NTEMP][NSHAP][NSIZE]) -> float {
+				float res = 0;
+				for (int c = 0; c < 8; ++c)
+					res += w[c] * v[if1 + ((c >> 2) & 1)][it1 + ((c >> 1) & 1)][s][ir1 + (c & 1)];
+				return res;
+			};
+			if (re) re[q] = d.reff[ir1][s] + ((d.reff[ir1 + 1][s] - d.reff[ir1][s]) * wr);
+			if (cabs) cabs[q] = blend(d.abss);
+			if (csca) csca[q] = blend(d.scas);
+			if (cbsc) cbsc[q] = blend(d.bscs);
+			if (g) g[q] = blend(d.gs);
+			if (p) {
+				// Each corner's phase function is contiguous, so this loop vectorizes.
+				float* out = p + ((size_t)q * NQ);
+				for (int k = 0; k < NQ; ++k) out[k] = 0;
+				for (int c = 0; c < 8; ++c) {
+					const float* v = d.pqs[if1 + ((c >> 2) & 1)][it1 + ((c >> 1) & 1)][s][ir1 + (c & 1)];
+					for (int k = 0; k < NQ; ++k) out[k] += w[c] * v[k];
+				}
+			}
+			if (iret) iret[q] = code;
+		}
+		return 0;
+	}
 #ifdef __cplusplus
 };
 #endif
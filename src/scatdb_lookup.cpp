@@ -0,0 +1,279 @@
+#include "../scatdb/defs.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#include "../scatdb/error.hpp"
+#include "../scatdb/scatdb.hpp"
+#include "../private/parallel.hpp"
+
+namespace {
+	/// Values below this are fill values
+	const float sentinel = -900.f;
+	/// Batches with at least this many points are split across threads
+	const size_t parallelQueries = 1 << 14;
+	/// Guards the lookup caches. It is held only to check or publish a table.
+	std::mutex m_lookups;
+
+	/// The cross sections are tabulated as log10, as in data_spline
+	inline bool isLogResponse(int k) { return k < 4; }
+
+	inline bool isValid(float v) { return !std::isnan(v) && v >= sentinel; }
+
+	/// Find the cell of an irregular axis that holds v. i0 is its lower node,
+	/// i1 its upper node and w the weight of i1. Values beyond the ends fail,
+	/// unless clamp is set, in which case they take the nearest node.
+	bool locate(const std::vector<float> &axis, float v, bool clamp,
+		size_t &i0, size_t &i1, float &w) {
+		const size_t n = axis.size();
+		if (!(v >= axis.front() && v <= axis.back())) {
+			if (!clamp || std::isnan(v)) return false;
+			i0 = i1 = (v < axis.front()) ? 0 : n - 1;
+			w = 0;
+			return true;
+		}
+		if (n == 1) {
+			i0 = i1 = 0;
+			w = 0;
+			return true;
+		}
+		i0 = (size_t)(std::upper_bound(axis.begin(), axis.end(), v) - axis.begin());
+		i0 = std::min(std::max(i0, (size_t)1), n - 1) - 1;
+		i1 = i0 + 1;
+		w = (v - axis[i0]) / (axis[i1] - axis[i0]);
+		return true;
+	}
+
+	/// Add w times one node record into acc
+	inline void accumulate(float* acc, const float* node, float w) {
+		using scatdb::db;
+#if defined(__AVX__)
+		_mm256_storeu_ps(acc, _mm256_add_ps(_mm256_loadu_ps(acc),
+			_mm256_mul_ps(_mm256_set1_ps(w), _mm256_loadu_ps(node))));
+#elif defined(__SSE2__) || defined(_M_X64)
+		const __m128 ws = _mm_set1_ps(w);
+		for (size_t k = 0; k < db::data_lookup::nodeStride; k += 4)
+			_mm_storeu_ps(acc + k, _mm_add_ps(_mm_loadu_ps(acc + k),
+				_mm_mul_ps(ws, _mm_loadu_ps(node + k))));
+#else
+		for (size_t k = 0; k < db::data_lookup::nodeStride; ++k)
+			acc[k] += w * node[k];
+#endif
+	}
+
+	/// Group key of a set of rows: (frequency, temperature)
+	typedef std::pair<float, float> groupKey;
+}
+
+namespace scatdb {
+	const size_t db::data_lookup::nodeStride;
+
+	db::data_lookup::data_lookup() : varnum(0) {}
+	db::data_lookup::~data_lookup() {}
+
+	std::shared_ptr<const db::data_lookup> db::data_lookup::generate(const db* src,
+		data_entries::data_entries_floats xaxis, size_t numSizes) {
+		return generate(src, nullptr, xaxis, numSizes);
+	}
+
+	std::shared_ptr<const db::data_lookup> db::data_lookup::generate(const db* src,
+		const RowIdsType &rows, data_entries::data_entries_floats xaxis, size_t numSizes) {
+		return generate(src, &rows, xaxis, numSizes);
+	}
+
+	std::shared_ptr<const db::data_lookup> db::data_lookup::generate(const db* src,
+		const RowIdsType *within, data_entries::data_entries_floats xaxis, size_t numSizes) {
+		if (!src) SDBR_throw(scatdb::error::error_types::xNullPointer)
+			.add<std::string>("Reason", "The source database is NULL.");
+		if (xaxis != data_entries::SDBR_AEFF_UM && xaxis != data_entries::SDBR_MAX_DIMENSION_MM)
+			SDBR_throw(scatdb::error::error_types::xBadInput)
+			.add<std::string>("Reason", "The size axis must be aeff or max dimension.")
+			.add<int>("xaxis", (int)xaxis);
+		if (numSizes < 2) SDBR_throw(scatdb::error::error_types::xBadInput)
+			.add<std::string>("Reason", "The size grid needs at least two nodes.")
+			.add<uint64_t>("numSizes", (uint64_t)numSizes);
+		static_assert(data_spline::numResponses <= (int)nodeStride,
+			"Each lookup node must hold every response");
+
+		// Group the rows by flake type, then by frequency and temperature
+		std::map<uint64_t, std::map<groupKey, RowIdsType> > groups;
+		const uint64_t n = (within) ? (uint64_t)within->size() : (uint64_t)src->floatMat.rows();
+		for (uint64_t i = 0; i < n; ++i) {
+			const uint64_t r = (within) ? (*within)[(size_t)i] : i;
+			const float f = src->floatMat((Eigen::Index)r, data_entries::SDBR_FREQUENCY_GHZ);
+			const float t = src->floatMat((Eigen::Index)r, data_entries::SDBR_TEMPERATURE_K);
+			const float x = src->floatMat((Eigen::Index)r, xaxis);
+			if (!isValid(f) || !isValid(t) || !isValid(x) || x <= 0) continue;
+			groups[src->intMat((Eigen::Index)r, data_entries::SDBR_FLAKETYPE)][groupKey(f, t)].push_back(r);
+		}
+
+		std::shared_ptr<data_lookup> res(new data_lookup);
+		res->varnum = (int)xaxis;
+		for (const auto &ft : groups) {
+			table tbl;
+			tbl.flaketype = ft.first;
+			float lo = std::numeric_limits<float>::max(), hi = 0;
+			for (const auto &g : ft.second) {
+				tbl.freqs.push_back(g.first.first);
+				tbl.temps.push_back(g.first.second);
+				for (const auto &r : g.second) {
+					const float x = src->floatMat((Eigen::Index)r, xaxis);
+					lo = std::min(lo, x);
+					hi = std::max(hi, x);
+				}
+			}
+			if (!(hi > lo)) continue;
+			std::sort(tbl.freqs.begin(), tbl.freqs.end());
+			tbl.freqs.erase(std::unique(tbl.freqs.begin(), tbl.freqs.end()), tbl.freqs.end());
+			std::sort(tbl.temps.begin(), tbl.temps.end());
+			tbl.temps.erase(std::unique(tbl.temps.begin(), tbl.temps.end()), tbl.temps.end());
+			const std::vector<double> grid = data_spline::logGrid(lo, hi, numSizes);
+			for (const auto &v : grid) tbl.sizes.push_back((float)v);
+			// The ends are exact, so that the bounds check in lookup is too
+			tbl.sizes.front() = lo;
+			tbl.sizes.back() = hi;
+			const size_t nt = tbl.temps.size();
+			tbl.values.assign(tbl.freqs.size() * nt * numSizes * nodeStride,
+				std::numeric_limits<float>::quiet_NaN());
+
+			// Each (frequency, temperature) group is splined along the size
+			// axis and sampled at the size nodes
+			for (const auto &g : ft.second) {
+				const size_t fi = (size_t)(std::lower_bound(tbl.freqs.begin(), tbl.freqs.end(),
+					g.first.first) - tbl.freqs.begin());
+				const size_t ti = (size_t)(std::lower_bound(tbl.temps.begin(), tbl.temps.end(),
+					g.first.second) - tbl.temps.begin());
+				auto sub = gatherRows(src, g.second);
+				std::shared_ptr<const data_spline> spl;
+				try {
+					spl = data_spline::generate(sub.get(), xaxis, data_spline::spline_type::SDBR_PCHIP);
+				}
+				catch (std::exception &) {
+					// Fewer than two usable sizes. These nodes stay uncovered.
+					continue;
+				}
+				auto sampled = spl->evaluate(grid);
+				float* node = tbl.values.data() + ((fi * nt + ti) * numSizes) * nodeStride;
+				for (size_t k = 0; k < numSizes; ++k, node += nodeStride) {
+					for (int c = 0; c < data_spline::numResponses; ++c) {
+						const float v = sampled->floatMat((Eigen::Index)k, data_spline::responseCols[c]);
+						if (!isValid(v)) node[c] = std::numeric_limits<float>::quiet_NaN();
+						else node[c] = (isLogResponse(c)) ? std::log10(v) : v;
+					}
+					for (size_t c = data_spline::numResponses; c < nodeStride; ++c)
+						node[c] = 0;
+				}
+			}
+			res->tables.push_back(std::move(tbl));
+		}
+		return res;
+	}
+
+	const db::data_lookup::table* db::data_lookup::findTable(uint64_t flaketype) const {
+		auto it = std::lower_bound(tables.begin(), tables.end(), flaketype,
+			[](const table &t, uint64_t ft) { return t.flaketype < ft; });
+		if (it == tables.end() || it->flaketype != flaketype) return nullptr;
+		return &(*it);
+	}
+
+	void db::data_lookup::lookup(size_t n, const uint64_t* flaketypes, const float* freqGHz,
+		const float* tempK, const float* sizes, float* out, size_t numThreads) const {
+		if (n && (!flaketypes || !freqGHz || !tempK || !sizes || !out))
+			SDBR_throw(scatdb::error::error_types::xNullPointer)
+			.add<std::string>("Reason", "A lookup array is NULL.");
+		const int nr = data_spline::numResponses;
+		const size_t numWorkers = (n < parallelQueries) ? 1
+			: parallel::resolveThreads(numThreads, n / (parallelQueries / 4));
+		parallel::runWorkers(numWorkers, [&](size_t t) {
+			const table* tbl = nullptr;
+			for (size_t i = (n * t) / numWorkers; i < (n * (t + 1)) / numWorkers; ++i) {
+				float* o = out + i * (size_t)nr;
+				if (!tbl || tbl->flaketype != flaketypes[i]) tbl = findTable(flaketypes[i]);
+				size_t f0, f1, t0, t1;
+				float wf, wt;
+				const float s = sizes[i];
+				if (!tbl || !(s >= tbl->sizes.front() && s <= tbl->sizes.back())
+					|| !locate(tbl->freqs, freqGHz[i], false, f0, f1, wf)
+					|| !locate(tbl->temps, tempK[i], true, t0, t1, wt)) {
+					std::fill(o, o + nr, std::numeric_limits<float>::quiet_NaN());
+					continue;
+				}
+				// The size nodes are evenly spaced in log10, so the cell is
+				// found directly instead of by searching
+				const size_t ns = tbl->sizes.size();
+				const double l0 = std::log10((double)tbl->sizes.front());
+				const double dl = (std::log10((double)tbl->sizes.back()) - l0) / (double)(ns - 1);
+				const double u = (std::log10((double)s) - l0) / dl;
+				const size_t s0 = std::min((size_t)std::max(u, 0.), ns - 2);
+				float ws = (float)std::min(std::max(u - (double)s0, 0.), 1.);
+				// Rounding in the logarithm must not give a node a small weight
+				// on its neighbor
+				if (s == tbl->sizes[s0]) ws = 0;
+				else if (s == tbl->sizes[s0 + 1]) ws = 1;
+
+				// The two size neighbors of a node are adjacent records
+				const size_t nt = tbl->temps.size();
+				const size_t fs[2] = { f0, f1 }, ts[2] = { t0, t1 };
+				const float wfs[2] = { 1.f - wf, wf }, wts[2] = { 1.f - wt, wt };
+				const float wss[2] = { 1.f - ws, ws };
+				// Corners with zero weight are skipped, so that a query that
+				// falls on a covered node or cell face is not spoiled by an
+				// uncovered (NaN) neighbor. A partly covered cell is not
+				// renormalized: any uncovered corner with nonzero weight still
+				// gives NaN.
+				float acc[nodeStride] = { 0 };
+				for (int a = 0; a < 2; ++a) {
+					for (int b = 0; b < 2; ++b) {
+						const float w = wfs[a] * wts[b];
+						if (w == 0) continue;
+						const float* node = tbl->values.data()
+							+ ((fs[a] * nt + ts[b]) * ns + s0) * nodeStride;
+						for (int c = 0; c < 2; ++c)
+							if (wss[c] != 0) accumulate(acc, node + c * nodeStride, w * wss[c]);
+					}
+				}
+				for (int c = 0; c < nr; ++c)
+					o[c] = (isLogResponse(c)) ? std::pow(10.f, acc[c]) : acc[c];
+			}
+		});
+	}
+
+	std::shared_ptr<const db::data_lookup> db::getLookup(
+		data_entries::data_entries_floats xaxis) const {
+		if ((int)xaxis < 0 || (int)xaxis >= data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS)
+			SDBR_throw(scatdb::error::error_types::xArrayOutOfBounds)
+			.add<int>("col", (int)xaxis);
+		{
+			std::lock_guard<std::mutex> lock(m_lookups);
+			if (this->pLookups[xaxis]) return this->pLookups[xaxis];
+		}
+		// The grid is built outside of the lock, so that other tables are not
+		// held up. If two threads race, the first result is kept.
+		auto res = data_lookup::generate(this, xaxis);
+		std::lock_guard<std::mutex> lock(m_lookups);
+		if (!this->pLookups[xaxis]) this->pLookups[xaxis] = res;
+		return this->pLookups[xaxis];
+	}
+
+	std::shared_ptr<const db::data_lookup> db_view::getLookup(
+		db::data_entries::data_entries_floats xaxis) const {
+		if ((int)xaxis < 0 || (int)xaxis >= db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS)
+			SDBR_throw(scatdb::error::error_types::xArrayOutOfBounds)
+			.add<int>("col", (int)xaxis);
+		{
+			std::lock_guard<std::mutex> lock(m_lookups);
+			if (this->pLookups[xaxis]) return this->pLookups[xaxis];
+		}
+		// Built outside of the lock, as in db::getLookup
+		auto res = db::data_lookup::generate(parent.get(), rows, xaxis);
+		std::lock_guard<std::mutex> lock(m_lookups);
+		if (!this->pLookups[xaxis]) this->pLookups[xaxis] = res;
+		return this->pLookups[xaxis];
+	}
+}
@@ -0,0 +1,128 @@
+#include "../scatdb/defs.hpp"
+#include <cmath>
+#include <complex>
+#include <memory>
+#include <vector>
+#include "../scatdb/error.hpp"
+#include "../scatdb/refract/refract.hpp"
+#include "../scatdb/scatdb.hpp"
+#include "../scatdb/units/units.hpp"
+
+namespace {
+	/// |K_w|^2 of liquid water at 273.15 K, which is the reference used when
+	/// converting backscatter into effective reflectivity.
+	float waterKw2(float freq_ghz) {
+		auto provWater = scatdb::refract::findProvider("water", true, true);
+		if (!provWater) SDBR_throw(scatdb::error::error_types::xBadFunctionReturn)
+			.add<std::string>("Reason", "provWater is null");
+		scatdb::refract::refractFunction_freq_temp_t r_water;
+		scatdb::refract::prepRefract(provWater, "GHz", "K", r_water);
+		std::complex<double> mWater;
+		r_water(freq_ghz, 273.15, mWater);
+		const std::complex<double> m2 = mWater * mWater;
+		const std::complex<double> Kwater = (m2 - std::complex<double>(1, 0)) /
+			(m2 + std::complex<double>(2, 0));
+		return (float)(Kwater * std::conj(Kwater)).real();
+	}
+}
+
+namespace scatdb {
+	db::data_psd::data_psd() : frequencyGHz(0), wavelengthM(0), kw2(0) {}
+	db::data_psd::~data_psd() {}
+
+	std::shared_ptr<const db::data_psd> db::data_psd::generate(const db* src,
+		const std::vector<float> &edges, const float* conc, size_t numProfiles) {
+		return generate(src, nullptr, edges, conc, numProfiles);
+	}
+
+	std::shared_ptr<const db::data_psd> db::data_psd::generate(const db* src,
+		const RowIdsType &rows, const std::vector<float> &edges,
+		const float* conc, size_t numProfiles) {
+		return generate(src, &rows, edges, conc, numProfiles);
+	}
+
+	std::shared_ptr<const db::data_psd> db::data_psd::generate(const db* src,
+		const RowIdsType *within, const std::vector<float> &edges,
+		const float* conc, size_t numProfiles) {
+		if (!src) SDBR_throw(scatdb::error::error_types::xNullPointer)
+			.add<std::string>("Reason", "The source database is NULL.");
+		if (numProfiles && !conc) SDBR_throw(scatdb::error::error_types::xNullPointer)
+			.add<std::string>("Reason", "The concentration table is NULL.");
+		const uint64_t numRows = (within) ? (uint64_t)within->size() : (uint64_t)src->floatMat.rows();
+		if (!numRows) SDBR_throw(scatdb::error::error_types::xBadInput)
+			.add<std::string>("Reason", "No database rows are left to integrate over.");
+
+		// A single binning pass groups the rows by size. The bin edges are
+		// validated there.
+		auto bins = (within)
+			? data_bins::generate(src, data_entries::SDBR_MAX_DIMENSION_MM, edges, *within)
+			: data_bins::generate(src, data_entries::SDBR_MAX_DIMENSION_MM, edges);
+		const size_t numBins = bins->numBins();
+
+		std::shared_ptr<data_psd> res(new data_psd);
+		res->edges = edges;
+		res->binCounts.resize(numBins);
+		res->binCbk.resize(numBins);
+		res->binCext.resize(numBins);
+		const stats_request medians(
+			(1ULL << data_entries::SDBR_CBK_M) | (1ULL << data_entries::SDBR_CEXT_M),
+			1ULL << data_entries::SDBR_MEDIAN);
+		for (size_t b = 0; b < numBins; ++b) {
+			res->binCounts[b] = bins->count(b);
+			if (!res->binCounts[b]) {
+				res->binCbk[b] = 0;
+				res->binCext[b] = 0;
+				continue;
+			}
+			auto s = data_stats::generate(src, bins->getRows(b), medians);
+			res->binCbk[b] = s->floatStats(data_entries::SDBR_MEDIAN, data_entries::SDBR_CBK_M);
+			res->binCext[b] = s->floatStats(data_entries::SDBR_MEDIAN, data_entries::SDBR_CEXT_M);
+		}
+
+		const stats_request freqMedian(1ULL << data_entries::SDBR_FREQUENCY_GHZ,
+			1ULL << data_entries::SDBR_MEDIAN);
+		auto fs = (within) ? data_stats::generate(src, *within, freqMedian)
+			: data_stats::generate(src, freqMedian);
+		res->frequencyGHz = fs->floatStats(data_entries::SDBR_MEDIAN, data_entries::SDBR_FREQUENCY_GHZ);
+		auto specConv_m = scatdb::units::conv_spec::generate("GHz", "m");
+		res->wavelengthM = (float)specConv_m->convert(res->frequencyGHz);
+		res->kw2 = waterKw2(res->frequencyGHz);
+
+		// The bin widths are folded into the cross sections, so that each
+		// profile is a pair of dot products over the bins.
+		Eigen::Matrix<float, Eigen::Dynamic, 1> wCbk(numBins), wCext(numBins);
+		for (size_t b = 0; b < numBins; ++b) {
+			const float binWidthM = (edges[b + 1] - edges[b]) / 1000.f;
+			wCbk((Eigen::Index)b) = res->binCbk[b] * binWidthM;
+			wCext((Eigen::Index)b) = res->binCext[b] * binWidthM;
+		}
+		res->backscatter.resize(numProfiles);
+		res->extinction.resize(numProfiles);
+		res->ze.resize(numProfiles);
+		if (numProfiles) {
+			typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> ConcType;
+			Eigen::Map<const ConcType> c(conc, (Eigen::Index)numProfiles, (Eigen::Index)numBins);
+			Eigen::Map<Eigen::Matrix<float, Eigen::Dynamic, 1> > bk(res->backscatter.data(), (Eigen::Index)numProfiles);
+			Eigen::Map<Eigen::Matrix<float, Eigen::Dynamic, 1> > ext(res->extinction.data(), (Eigen::Index)numProfiles);
+			bk.noalias() = c * wCbk;
+			ext.noalias() = c * wCext;
+		}
+		// Ze = lambda^4 / (pi^5 |K_w|^2) * backscatter, converted from m^3 to mm^6 m^-3
+		const double pi = 3.14159265358979;
+		const double zeFactor = std::pow((double)res->wavelengthM, 4.)
+			/ (std::pow(pi, 5.) * (double)res->kw2) * 1.e18;
+		for (size_t p = 0; p < numProfiles; ++p)
+			res->ze[p] = (float)(zeFactor * (double)res->backscatter[p]);
+		return res;
+	}
+
+	std::shared_ptr<const db::data_psd> db::integratePSD(const std::vector<float> &edges,
+		const float* conc, size_t numProfiles) const {
+		return data_psd::generate(this, edges, conc, numProfiles);
+	}
+
+	std::shared_ptr<const db::data_psd> db_view::integratePSD(const std::vector<float> &edges,
+		const float* conc, size_t numProfiles) const {
+		return db::data_psd::generate(parent.get(), rows, edges, conc, numProfiles);
+	}
+}
@@ -0,0 +1,137 @@
+#include "../scatdb/defs.hpp"
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "../scatdb/error.hpp"
+#include "../scatdb/scatdb.hpp"
+#include "../private/parallel.hpp"
+
+namespace {
+	/// Tables with at least this many rows are sorted on several threads
+	const size_t parallelRows = 1 << 16;
+	/// Each radix pass sorts on this many bits of the key
+	const int radixBits = 11;
+	const uint32_t radixSize = 1u << radixBits;
+
+	/// Map a float onto an unsigned integer with the same ordering. Negative
+	/// and positive zero compare equal, and NaNs go after everything else.
+	inline uint32_t sortableKey(float v) {
+		if (v != v) return 0xFFFFFFFFu;
+		if (v == 0) v = 0;
+		uint32_t u;
+		std::memcpy(&u, &v, sizeof(u));
+		return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+	}
+
+	/// One stable counting pass on the digit at shift. Each worker counts
+	/// its own chunk, and the workers' output ranges are laid out bucket by
+	/// bucket, in worker order, so that equal digits keep their order.
+	/// Returns false (and moves nothing) if every key has the same digit.
+	bool radixPass(std::vector<uint32_t> &keys, std::vector<uint64_t> &ids,
+		std::vector<uint32_t> &tkeys, std::vector<uint64_t> &tids,
+		int shift, size_t numWorkers) {
+		using namespace scatdb;
+		const size_t n = keys.size();
+		auto chunkBegin = [&](size_t t) -> size_t { return (n * t) / numWorkers; };
+		std::vector<std::vector<uint64_t> > counts(numWorkers, std::vector<uint64_t>(radixSize, 0));
+		parallel::runWorkers(numWorkers, [&](size_t t) {
+			uint64_t* c = counts[t].data();
+			for (size_t i = chunkBegin(t); i < chunkBegin(t + 1); ++i)
+				c[(keys[i] >> shift) & (radixSize - 1)]++;
+		});
+		uint64_t running = 0;
+		for (uint32_t b = 0; b < radixSize; ++b) {
+			uint64_t total = 0;
+			for (size_t t = 0; t < numWorkers; ++t) total += counts[t][b];
+			if (total == (uint64_t)n) return false;
+			for (size_t t = 0; t < numWorkers; ++t) {
+				const uint64_t c = counts[t][b];
+				counts[t][b] = running;
+				running += c;
+			}
+		}
+		parallel::runWorkers(numWorkers, [&](size_t t) {
+			uint64_t* pos = counts[t].data();
+			for (size_t i = chunkBegin(t); i < chunkBegin(t + 1); ++i) {
+				const size_t dest = (size_t)pos[(keys[i] >> shift) & (radixSize - 1)]++;
+				tkeys[dest] = keys[i];
+				tids[dest] = ids[i];
+			}
+		});
+		keys.swap(tkeys);
+		ids.swap(tids);
+		return true;
+	}
+
+	/// Shared by db and db_view. Returns the row numbers of src, in sorted
+	/// order. If within is set, only those rows are sorted.
+	scatdb::db::RowIdsType sortRows(const scatdb::db* src, const scatdb::db::RowIdsType* within,
+		const std::vector<scatdb::db::data_entries::data_entries_floats> &sortKeys) {
+		using namespace scatdb;
+		if (sortKeys.empty()) SDBR_throw(scatdb::error::error_types::xBadInput)
+			.add<std::string>("Reason", "At least one sort key is needed.");
+		for (const auto &k : sortKeys)
+			if ((int)k < 0 || (int)k >= db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS)
+				SDBR_throw(scatdb::error::error_types::xArrayOutOfBounds)
+				.add<int>("col", (int)k);
+		const size_t n = (within) ? within->size() : (size_t)src->floatMat.rows();
+		auto rowOf = [&](uint64_t i) -> uint64_t { return (within) ? (*within)[(size_t)i] : i; };
+
+		std::shared_ptr<const db::data_columns> cols;
+		if (db::useColumnStore()) cols = src->getColumns();
+		const size_t numWorkers = (n < parallelRows) ? 1
+			: parallel::resolveThreads(0, n / (parallelRows / 4));
+
+		// LSD radix sort: the least significant key goes first, and every
+		// later pass is stable, so earlier keys only break ties.
+		std::vector<uint64_t> ids(n), tids(n);
+		std::vector<uint32_t> keys(n), tkeys(n);
+		for (size_t i = 0; i < n; ++i) ids[i] = (uint64_t)i;
+		for (auto k = sortKeys.rbegin(); k != sortKeys.rend(); ++k) {
+			const float* vals = (cols) ? cols->floatData(*k) : src->floatMat.data() + *k;
+			const size_t stride = (cols) ? 1 : db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS;
+			parallel::runWorkers(numWorkers, [&](size_t t) {
+				for (size_t i = (n * t) / numWorkers; i < (n * (t + 1)) / numWorkers; ++i)
+					keys[i] = sortableKey(vals[rowOf(ids[i]) * stride]);
+			});
+			for (int shift = 0; shift < 32; shift += radixBits)
+				radixPass(keys, ids, tkeys, tids, shift, numWorkers);
+		}
+		for (size_t i = 0; i < n; ++i) ids[i] = rowOf(ids[i]);
+		return ids;
+	}
+}
+
+namespace scatdb {
+	db::RowIdsType db::sortPermutation(
+		const std::vector<data_entries::data_entries_floats> &keys) const {
+		return sortRows(this, nullptr, keys);
+	}
+
+	db::RowIdsType db::sortPermutation(
+		const std::vector<data_entries::data_entries_floats> &keys,
+		const RowIdsType &rows) const {
+		return sortRows(this, &rows, keys);
+	}
+
+	std::shared_ptr<const db> db::sort(
+		const std::vector<data_entries::data_entries_floats> &keys) const {
+		return gatherRows(this, sortPermutation(keys));
+	}
+
+	std::shared_ptr<const db> db::sort(
+		db::data_entries::data_entries_floats xaxis) const {
+		std::vector<data_entries::data_entries_floats> keys(1, xaxis);
+		keys.push_back((xaxis == data_entries::SDBR_AEFF_UM)
+			? data_entries::SDBR_MAX_DIMENSION_MM : data_entries::SDBR_AEFF_UM);
+		return sort(keys);
+	}
+
+	std::shared_ptr<const db_view> db_view::sort(
+		const std::vector<db::data_entries::data_entries_floats> &keys) const {
+		std::shared_ptr<db_view> res(new db_view);
+		res->parent = parent;
+		res->rows = sortRows(parent.get(), &rows, keys);
+		return res;
+	}
+}
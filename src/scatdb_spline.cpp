@@ -0,0 +1,296 @@
+#include "../scatdb/defs.hpp"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "../scatdb/error.hpp"
+#include "../scatdb/scatdb.hpp"
+
+namespace {
+	/// Values below this are fill values
+	const float sentinel = -900.f;
+	/// Knots closer than this (relative) are merged
+	const double dupTolerance = 0.000001;
+	/// Guards the per-type spline caches
+	std::mutex m_splines;
+
+	typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> KnotMatType;
+
+	/// The cross sections are fitted in log10 space
+	inline bool isLogResponse(int k) { return k < 4; }
+
+	/// Natural cubic spline coefficients, for all responses at once. The
+	/// second derivatives come from one tridiagonal solve with a column of
+	/// right-hand sides per response.
+	void cubicCoeffs(const std::vector<double> &x, const KnotMatType &y, KnotMatType &coeffs) {
+		const size_t m = x.size(), nr = (size_t)y.cols();
+		KnotMatType M = KnotMatType::Zero((Eigen::Index)m, (Eigen::Index)nr);
+		if (m > 2) {
+			// Thomas algorithm on rows 1 to m-2, with M[0] = M[m-1] = 0
+			std::vector<double> cprime(m, 0);
+			KnotMatType d((Eigen::Index)m, (Eigen::Index)nr);
+			for (size_t k = 1; k + 1 < m; ++k) {
+				const double h0 = x[k] - x[k - 1], h1 = x[k + 1] - x[k];
+				const double diag = 2. * (h0 + h1) - ((k > 1) ? h0 * cprime[k - 1] : 0.);
+				cprime[k] = h1 / diag;
+				for (size_t c = 0; c < nr; ++c) {
+					const double rhs = 6. * (((y(k + 1, c) - y(k, c)) / h1) - ((y(k, c) - y(k - 1, c)) / h0));
+					d(k, c) = (rhs - ((k > 1) ? h0 * d(k - 1, c) : 0.)) / diag;
+				}
+			}
+			for (size_t k = m - 2; k >= 1; --k) {
+				for (size_t c = 0; c < nr; ++c)
+					M(k, c) = d(k, c) - ((k + 2 < m) ? cprime[k] * M(k + 1, c) : 0.);
+			}
+		}
+		for (size_t k = 0; k + 1 < m; ++k) {
+			const double h = x[k + 1] - x[k];
+			for (size_t c = 0; c < nr; ++c) {
+				const double delta = (y(k + 1, c) - y(k, c)) / h;
+				coeffs(k, 4 * c) = y(k, c);
+				coeffs(k, 4 * c + 1) = delta - h * (2. * M(k, c) + M(k + 1, c)) / 6.;
+				coeffs(k, 4 * c + 2) = M(k, c) / 2.;
+				coeffs(k, 4 * c + 3) = (M(k + 1, c) - M(k, c)) / (6. * h);
+			}
+		}
+	}
+
+	/// PCHIP end slope (three-point formula, limited to keep the shape)
+	double pchipEnd(double h0, double h1, double d0, double d1) {
+		double s = ((2. * h0 + h1) * d0 - h0 * d1) / (h0 + h1);
+		if ((s > 0) != (d0 > 0) || d0 == 0) s = 0;
+		else if (((d0 > 0) != (d1 > 0)) && std::abs(s) > std::abs(3. * d0)) s = 3. * d0;
+		return s;
+	}
+
+	/// Fritsch-Carlson monotone cubic Hermite coefficients, for all responses
+	void pchipCoeffs(const std::vector<double> &x, const KnotMatType &y, KnotMatType &coeffs) {
+		const size_t m = x.size(), nr = (size_t)y.cols();
+		std::vector<double> h(m - 1), delta(m - 1), slope(m);
+		for (size_t k = 0; k + 1 < m; ++k) h[k] = x[k + 1] - x[k];
+		for (size_t c = 0; c < nr; ++c) {
+			for (size_t k = 0; k + 1 < m; ++k)
+				delta[k] = (y(k + 1, c) - y(k, c)) / h[k];
+			if (m == 2) {
+				slope[0] = slope[1] = delta[0];
+			} else {
+				for (size_t k = 1; k + 1 < m; ++k) {
+					if (delta[k - 1] * delta[k] <= 0) {
+						slope[k] = 0;
+						continue;
+					}
+					const double w1 = 2. * h[k] + h[k - 1], w2 = h[k] + 2. * h[k - 1];
+					slope[k] = (w1 + w2) / ((w1 / delta[k - 1]) + (w2 / delta[k]));
+				}
+				slope[0] = pchipEnd(h[0], h[1], delta[0], delta[1]);
+				slope[m - 1] = pchipEnd(h[m - 2], h[m - 3], delta[m - 2], delta[m - 3]);
+			}
+			for (size_t k = 0; k + 1 < m; ++k) {
+				coeffs(k, 4 * c) = y(k, c);
+				coeffs(k, 4 * c + 1) = slope[k];
+				coeffs(k, 4 * c + 2) = (3. * delta[k] - 2. * slope[k] - slope[k + 1]) / h[k];
+				coeffs(k, 4 * c + 3) = (slope[k] + slope[k + 1] - 2. * delta[k]) / (h[k] * h[k]);
+			}
+		}
+	}
+
+	/// Shared by the db and db_view caches
+	template <class T>
+	std::shared_ptr<const scatdb::db::data_spline> cachedSpline(
+		std::map<std::pair<int, int>, std::shared_ptr<const scatdb::db::data_spline> > &cache,
+		scatdb::db::data_entries::data_entries_floats xaxis,
+		scatdb::db::data_spline::spline_type type, T fit) {
+		const std::pair<int, int> key((int)xaxis, (int)type);
+		{
+			std::lock_guard<std::mutex> lock(m_splines);
+			auto it = cache.find(key);
+			if (it != cache.end()) return it->second;
+		}
+		auto res = fit();
+		std::lock_guard<std::mutex> lock(m_splines);
+		cache[key] = res;
+		return res;
+	}
+
+	/// The default grid: every 10 um of aeff, or every 0.1 mm of max
+	/// dimension, within the range of the knots
+	std::vector<double> defaultGrid(const scatdb::db::data_spline &s) {
+		const double step = (s.varnum == scatdb::db::data_entries::SDBR_AEFF_UM) ? 10. : 0.1;
+		const long first = (long)std::ceil(s.x.front() / step);
+		const long last = (long)std::floor(s.x.back() / step);
+		std::vector<double> res;
+		for (long i = first; i <= last; ++i) res.push_back((double)i * step);
+		return res;
+	}
+}
+
+namespace scatdb {
+	const int db::data_spline::numResponses;
+	const int db::data_spline::responseCols[db::data_spline::numResponses] = {
+		db::data_entries::SDBR_CABS_M, db::data_entries::SDBR_CBK_M,
+		db::data_entries::SDBR_CEXT_M, db::data_entries::SDBR_CSCA_M,
+		db::data_entries::SDBR_G };
+
+	db::data_spline::data_spline() : varnum(0), type(spline_type::SDBR_PCHIP) {}
+	db::data_spline::~data_spline() {}
+
+	std::shared_ptr<const db::data_spline> db::data_spline::generate(const db* src,
+		data_entries::data_entries_floats xaxis, spline_type type) {
+		return generate(src, nullptr, xaxis, type);
+	}
+
+	std::shared_ptr<const db::data_spline> db::data_spline::generate(const db* src,
+		const RowIdsType &rows, data_entries::data_entries_floats xaxis, spline_type type) {
+		return generate(src, &rows, xaxis, type);
+	}
+
+	std::shared_ptr<const db::data_spline> db::data_spline::generate(const db* src,
+		const RowIdsType *within, data_entries::data_entries_floats xaxis, spline_type type) {
+		if (!src) SDBR_throw(scatdb::error::error_types::xNullPointer)
+			.add<std::string>("Reason", "The source database is NULL.");
+		if ((int)xaxis < 0 || (int)xaxis >= data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS)
+			SDBR_throw(scatdb::error::error_types::xArrayOutOfBounds)
+			.add<int>("col", (int)xaxis);
+
+		// Gather the usable rows, sorted by x. Only the selected rows are sorted.
+		const std::vector<data_entries::data_entries_floats> keys(1, xaxis);
+		const RowIdsType order = (within) ? src->sortPermutation(keys, *within)
+			: src->sortPermutation(keys);
+
+		std::shared_ptr<data_spline> res(new data_spline);
+		res->varnum = (int)xaxis;
+		res->type = type;
+		// Merge rows with (nearly) the same x into one knot, averaging the
+		// responses. Rows with fill values are skipped.
+		std::vector<double> sums(numResponses);
+		std::vector<double> knotY;
+		size_t count = 0;
+		auto flush = [&]() {
+			if (!count) return;
+			for (int c = 0; c < numResponses; ++c) knotY.push_back(sums[c] / (double)count);
+			count = 0;
+		};
+		for (const auto &r : order) {
+			const float xv = src->floatMat((Eigen::Index)r, xaxis);
+			if (std::isnan(xv) || xv < sentinel) continue;
+			bool ok = true;
+			double vals[numResponses];
+			for (int c = 0; c < numResponses; ++c) {
+				const float v = src->floatMat((Eigen::Index)r, responseCols[c]);
+				if (std::isnan(v) || v < sentinel || (isLogResponse(c) && v <= 0)) {
+					ok = false;
+					break;
+				}
+				vals[c] = (isLogResponse(c)) ? std::log10((double)v) : (double)v;
+			}
+			if (!ok) continue;
+			const double x = (double)xv;
+			if (res->x.empty() || std::abs(x - res->x.back()) > dupTolerance * std::abs(x)) {
+				flush();
+				res->x.push_back(x);
+				std::fill(sums.begin(), sums.end(), 0.);
+			}
+			for (int c = 0; c < numResponses; ++c) sums[c] += vals[c];
+			++count;
+		}
+		flush();
+		const size_t m = res->x.size();
+		if (m < 2) SDBR_throw(scatdb::error::error_types::xBadInput)
+			.add<std::string>("Reason", "A spline needs at least two distinct x values.")
+			.add<uint64_t>("numKnots", (uint64_t)m);
+		const KnotMatType y = Eigen::Map<const KnotMatType>(knotY.data(), (Eigen::Index)m, numResponses);
+
+		res->coeffs.resize((Eigen::Index)(m - 1), 4 * numResponses);
+		if (type == spline_type::SDBR_CUBIC) cubicCoeffs(res->x, y, res->coeffs);
+		else pchipCoeffs(res->x, y, res->coeffs);
+		return res;
+	}
+
+	std::shared_ptr<const db> db::data_spline::evaluate(const std::vector<double> &grid) const {
+		std::shared_ptr<db> res(new db);
+		const Eigen::Index n = (Eigen::Index)grid.size();
+		res->floatMat.resize(n, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS);
+		res->intMat.resize(n, data_entries::SDBR_NUM_DATA_ENTRIES_INTS);
+		res->floatMat.fill(-999);
+		res->intMat.fill((uint64_t)-999);
+		const size_t numSegs = (size_t)coeffs.rows();
+		const bool ascending = std::is_sorted(grid.begin(), grid.end());
+		size_t seg = 0;
+		for (Eigen::Index i = 0; i < n; ++i) {
+			const double xq = grid[(size_t)i];
+			res->floatMat(i, varnum) = (float)xq;
+			if (!(xq >= x.front() && xq <= x.back())) continue;
+			// Segment k covers x[k] <= xq < x[k+1]. The last one also takes x.back().
+			if (ascending) {
+				while (seg + 1 < numSegs && x[seg + 1] <= xq) ++seg;
+			} else {
+				seg = (size_t)(std::upper_bound(x.begin(), x.end(), xq) - x.begin());
+				seg = (seg == 0) ? 0 : std::min(seg - 1, numSegs - 1);
+			}
+			const double t = xq - x[seg];
+			const double* a = coeffs.data() + seg * (size_t)coeffs.cols();
+			for (int c = 0; c < numResponses; ++c) {
+				const double* p = a + 4 * c;
+				const double v = p[0] + t * (p[1] + t * (p[2] + t * p[3]));
+				res->floatMat(i, responseCols[c]) = (float)((isLogResponse(c)) ? std::pow(10., v) : v);
+			}
+		}
+		return res;
+	}
+
+	std::vector<double> db::data_spline::linearGrid(double lo, double hi, size_t n) {
+		std::vector<double> res(n);
+		if (n == 1) res[0] = lo;
+		for (size_t i = 0; n > 1 && i < n; ++i)
+			res[i] = lo + (hi - lo) * ((double)i / (double)(n - 1));
+		if (n > 1) res[n - 1] = hi;
+		return res;
+	}
+
+	std::vector<double> db::data_spline::logGrid(double lo, double hi, size_t n) {
+		if (!(lo > 0) || !(hi > 0)) SDBR_throw(scatdb::error::error_types::xBadInput)
+			.add<std::string>("Reason", "Log-spaced grids need positive bounds.")
+			.add<double>("lo", lo)
+			.add<double>("hi", hi);
+		std::vector<double> res = linearGrid(std::log10(lo), std::log10(hi), n);
+		for (auto &v : res) v = std::pow(10., v);
+		if (n) res[0] = lo;
+		if (n > 1) res[n - 1] = hi;
+		return res;
+	}
+
+	std::shared_ptr<const db::data_spline> db::getSpline(
+		data_entries::data_entries_floats xaxis, data_spline::spline_type type) const {
+		return cachedSpline(pSplines, xaxis, type, [&]() {
+			return data_spline::generate(this, xaxis, type); });
+	}
+
+	std::shared_ptr<const db> db::interpolate(
+		data_entries::data_entries_floats xaxis, data_spline::spline_type type) const {
+		auto s = getSpline(xaxis, type);
+		return s->evaluate(defaultGrid(*s));
+	}
+
+	std::shared_ptr<const db> db::interpolate(const std::vector<double> &grid,
+		data_entries::data_entries_floats xaxis, data_spline::spline_type type) const {
+		return getSpline(xaxis, type)->evaluate(grid);
+	}
+
+	std::shared_ptr<const db::data_spline> db_view::getSpline(
+		db::data_entries::data_entries_floats xaxis, db::data_spline::spline_type type) const {
+		return cachedSpline(pSplines, xaxis, type, [&]() {
+			return db::data_spline::generate(parent.get(), rows, xaxis, type); });
+	}
+
+	std::shared_ptr<const db> db_view::interpolate(
+		db::data_entries::data_entries_floats xaxis, db::data_spline::spline_type type) const {
+		auto s = getSpline(xaxis, type);
+		return s->evaluate(defaultGrid(*s));
+	}
+
+	std::shared_ptr<const db> db_view::interpolate(const std::vector<double> &grid,
+		db::data_entries::data_entries_floats xaxis, db::data_spline::spline_type type) const {
+		return getSpline(xaxis, type)->evaluate(grid);
+	}
+}
@@ -1,68 +1,455 @@
 #include "../scatdb/defs.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <memory>
-#include <tuple>
-#include <boost/accumulators/accumulators.hpp>
-#include <boost/accumulators/statistics.hpp>
-#include <boost/accumulators/statistics/covariance.hpp>
-#include <boost/accumulators/statistics/density.hpp>
-#include <boost/accumulators/statistics/stats.hpp>
-#include <boost/accumulators/statistics/kurtosis.hpp>
-#include <boost/accumulators/statistics/max.hpp>
-#include <boost/accumulators/statistics/mean.hpp>
-#include <boost/accumulators/statistics/min.hpp>
-#include <boost/accumulators/statistics/median.hpp>
-#include <boost/accumulators/statistics/moment.hpp>
-#include <boost/accumulators/statistics/skewness.hpp>
-#include <boost/accumulators/statistics/variance.hpp>
-#include <boost/accumulators/statistics/variates/covariate.hpp>
+#include <mutex>
+#include <vector>
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 #include "../scatdb/scatdb.hpp"
+#include "../private/parallel.hpp"
+#include "../private/queryCache.hpp"
+
+namespace {
+	/// Values below this are fill values, and are left out of the statistics
+	const float sentinel = -900.f;
+	/// Columns are summarized on separate threads once a table has this many rows
+	const size_t parallelRows = 1 << 16;
+	/// Guards the per-request stats caches
+	std::mutex m_stats;
+
+	/// Running sums for one column. The power sums are taken about a shift
+	/// value close to the data, which keeps the central moments accurate.
+	struct moments {
+		float mn, mx;
+		double s1, s2, s3, s4;
+		moments() : mn(std::numeric_limits<float>::infinity()),
+			mx(-std::numeric_limits<float>::infinity()), s1(0), s2(0), s3(0), s4(0) {}
+	};
+
+	/// Accumulate min, max and the first four shifted power sums of v[0..n)
+	/// in a single pass.
+	void accumulate(const float* v, size_t n, double shift, moments &m) {
+		size_t i = 0;
+#if defined(__AVX2__)
+		if (n >= 4) {
+			__m128 mn = _mm_set1_ps(m.mn), mx = _mm_set1_ps(m.mx);
+			__m256d s1 = _mm256_setzero_pd(), s2 = _mm256_setzero_pd(),
+				s3 = _mm256_setzero_pd(), s4 = _mm256_setzero_pd();
+			const __m256d k = _mm256_set1_pd(shift);
+			for (; i + 4 <= n; i += 4) {
+				const __m128 x = _mm_loadu_ps(v + i);
+				mn = _mm_min_ps(mn, x);
+				mx = _mm_max_ps(mx, x);
+				const __m256d d = _mm256_sub_pd(_mm256_cvtps_pd(x), k);
+				const __m256d d2 = _mm256_mul_pd(d, d);
+				s1 = _mm256_add_pd(s1, d);
+				s2 = _mm256_add_pd(s2, d2);
+				s3 = _mm256_add_pd(s3, _mm256_mul_pd(d2, d));
+				s4 = _mm256_add_pd(s4, _mm256_mul_pd(d2, d2));
+			}
+			float fmn[4], fmx[4];
+			double ds[4][4];
+			_mm_storeu_ps(fmn, mn);
+			_mm_storeu_ps(fmx, mx);
+			_mm256_storeu_pd(ds[0], s1);
+			_mm256_storeu_pd(ds[1], s2);
+			_mm256_storeu_pd(ds[2], s3);
+			_mm256_storeu_pd(ds[3], s4);
+			for (int l = 0; l < 4; ++l) {
+				m.mn = std::min(m.mn, fmn[l]);
+				m.mx = std::max(m.mx, fmx[l]);
+				m.s1 += ds[0][l];
+				m.s2 += ds[1][l];
+				m.s3 += ds[2][l];
+				m.s4 += ds[3][l];
+			}
+		}
+#elif defined(__SSE2__) || defined(_M_X64)
+		if (n >= 4) {
+			__m128 mn = _mm_set1_ps(m.mn), mx = _mm_set1_ps(m.mx);
+			__m128d s1 = _mm_setzero_pd(), s2 = _mm_setzero_pd(),
+				s3 = _mm_setzero_pd(), s4 = _mm_setzero_pd();
+			const __m128d k = _mm_set1_pd(shift);
+			for (; i + 4 <= n; i += 4) {
+				const __m128 x = _mm_loadu_ps(v + i);
+				mn = _mm_min_ps(mn, x);
+				mx = _mm_max_ps(mx, x);
+				// Widen the low and the high halves to doubles
+				const __m128d halves[2] = { _mm_cvtps_pd(x), _mm_cvtps_pd(_mm_movehl_ps(x, x)) };
+				for (int h = 0; h < 2; ++h) {
+					const __m128d d = _mm_sub_pd(halves[h], k);
+					const __m128d d2 = _mm_mul_pd(d, d);
+					s1 = _mm_add_pd(s1, d);
+					s2 = _mm_add_pd(s2, d2);
+					s3 = _mm_add_pd(s3, _mm_mul_pd(d2, d));
+					s4 = _mm_add_pd(s4, _mm_mul_pd(d2, d2));
+				}
+			}
+			float fmn[4], fmx[4];
+			double ds[4][2];
+			_mm_storeu_ps(fmn, mn);
+			_mm_storeu_ps(fmx, mx);
+			_mm_storeu_pd(ds[0], s1);
+			_mm_storeu_pd(ds[1], s2);
+			_mm_storeu_pd(ds[2], s3);
+			_mm_storeu_pd(ds[3], s4);
+			for (int l = 0; l < 4; ++l) {
+				m.mn = std::min(m.mn, fmn[l]);
+				m.mx = std::max(m.mx, fmx[l]);
+			}
+			for (int l = 0; l < 2; ++l) {
+				m.s1 += ds[0][l];
+				m.s2 += ds[1][l];
+				m.s3 += ds[2][l];
+				m.s4 += ds[3][l];
+			}
+		}
+#endif
+		for (; i < n; ++i) {
+			m.mn = std::min(m.mn, v[i]);
+			m.mx = std::max(m.mx, v[i]);
+			const double d = (double)v[i] - shift;
+			const double d2 = d * d;
+			m.s1 += d;
+			m.s2 += d2;
+			m.s3 += d2 * d;
+			m.s4 += d2 * d2;
+		}
+	}
+
+	/// Exact median. The values are reordered.
+	float median(std::vector<float> &v, size_t n) {
+		if (!n) return 0;
+		const size_t mid = n / 2;
+		std::nth_element(v.begin(), v.begin() + mid, v.begin() + n);
+		if (n % 2) return v[mid];
+		// The lower middle value is the largest of the lower half
+		const float lower = *std::max_element(v.begin(), v.begin() + mid);
+		return (float)(((double)lower + (double)v[mid]) / 2.);
+	}
+
+	/// Pack the valid values of one column into vals and return how many there
+	/// are. The write always happens, and the position only advances for
+	/// values that are not fill values.
+	size_t packColumn(const scatdb::db* src, const scatdb::db::data_columns* cols,
+		const scatdb::db::RowIdsType* rows, size_t numRows, int j, std::vector<float> &vals) {
+		const size_t numCols = scatdb::db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS;
+		const float* col = (cols) ? cols->floatData(j) : src->floatMat.data() + j;
+		const size_t stride = (cols) ? 1 : numCols;
+		size_t n = 0;
+		for (size_t i = 0; i < numRows; ++i) {
+			const size_t r = (rows) ? (size_t)(*rows)[i] : i;
+			const float val = col[r*stride];
+			vals[n] = val;
+			n += (size_t)(val >= sentinel);
+		}
+		return n;
+	}
+
+	/// Central moments of n packed values: the mean and the mean second to
+	/// fourth powers of the deviations from it.
+	struct central {
+		float mn, mx;
+		double mean, c2, c3, c4;
+		central() : mn(0), mx(0), mean(0), c2(0), c3(0), c4(0) {}
+	};
+	central centralMoments(const float* vals, size_t n) {
+		moments m;
+		const double shift = (n) ? (double)vals[0] : 0.;
+		accumulate(vals, n, shift, m);
+		const double dn = (double)n;
+		const double d = m.s1 / dn;
+		const double m2 = m.s2 / dn, m3 = m.s3 / dn, m4 = m.s4 / dn;
+		central res;
+		res.mn = m.mn;
+		res.mx = m.mx;
+		res.mean = shift + d;
+		res.c2 = (n) ? std::max(0., m2 - (d*d)) : 0.;
+		res.c3 = m3 - (3.*d*m2) + (2.*d*d*d);
+		res.c4 = m4 - (4.*d*m3) + (6.*d*d*m2) - (3.*d*d*d*d);
+		return res;
+	}
+
+	/// Fill in the requested statistics for one column of the stats table
+	void setColumn(scatdb::db::StatsFloatType &out, int j, float mn, float mx,
+		double mean, double c2, double c3, double c4, float med,
+		const scatdb::db::stats_request &req = scatdb::db::stats_request()) {
+		using scatdb::db;
+		float vals[db::data_entries::SDBR_NUM_DATA_ENTRIES_STATS];
+		vals[db::data_entries::SDBR_S_MIN] = mn;
+		vals[db::data_entries::SDBR_S_MAX] = mx;
+		vals[db::data_entries::SDBR_MEAN] = (float)mean;
+		vals[db::data_entries::SDBR_MEDIAN] = med;
+		vals[db::data_entries::SDBR_SKEWNESS] = (float)(c3 / std::pow(c2, 1.5));
+		vals[db::data_entries::SDBR_KURTOSIS] = (float)((c4 / (c2*c2)) - 3.);
+		vals[db::data_entries::SDBR_SD] = (float)std::sqrt(c2);
+		for (int k = 0; k < db::data_entries::SDBR_NUM_DATA_ENTRIES_STATS; ++k)
+			if (req.wantStat(k)) out(k, j) = vals[k];
+	}
+}
 
 namespace scatdb {
-	std::shared_ptr<const db::data_stats> db::data_stats::generate(const db* src) {
+	namespace {
+		const uint64_t allColumns = (1ULL << db::data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS) - 1;
+		const uint64_t allStats = (1ULL << db::data_entries::SDBR_NUM_DATA_ENTRIES_STATS) - 1;
+	}
+	db::stats_request::stats_request() : columns(allColumns), stats(allStats) {}
+	// Unused bits are dropped, so that equivalent requests share a cache entry
+	db::stats_request::stats_request(uint64_t columns, uint64_t stats)
+		: columns(columns & allColumns), stats(stats & allStats) {}
+	bool db::stats_request::wantColumn(int col) const { return (columns >> col) & 1; }
+	bool db::stats_request::wantStat(int stat) const { return (stats >> stat) & 1; }
+	bool db::stats_request::operator<(const stats_request &rhs) const {
+		if (columns != rhs.columns) return columns < rhs.columns;
+		return stats < rhs.stats;
+	}
+	bool db::stats_request::operator==(const stats_request &rhs) const {
+		return (columns == rhs.columns) && (stats == rhs.stats);
+	}
+
+	std::shared_ptr<const db::data_stats> db::data_stats::generate(const db* src,
+		const stats_request &req) {
+		return generate(src, (const RowIdsType*) nullptr, req);
+	}
+
+	std::shared_ptr<const db::data_stats> db::data_stats::generate(
+		const db* src, const RowIdsType &rows, const stats_request &req) {
+		return generate(src, &rows, req);
+	}
+
+	std::shared_ptr<const db::data_stats> db::data_stats::generate(
+		const db* src, const RowIdsType *rows, const stats_request &req) {
 		std::shared_ptr<db::data_stats> res(new db::data_stats);
+		res->request = req;
 		if (!src) return res;
-		using namespace boost::accumulators;
-		// NOTE: Using doubles instead of floats to avoid annoying boost internal library warnings
-		typedef accumulator_set<double, boost::accumulators::stats <
-			tag::min,
-			tag::max,
-			tag::mean,
-			tag::median,
-			tag::skewness,
-			tag::kurtosis,
-			tag::variance
-		> > acc_type;
-
-		// Push the data to the accumulator functions.
-		std::vector<acc_type> accs(data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS);
-		for (int i = 0; i<src->floatMat.rows(); ++i) {
-			for (int j = 0; j<src->floatMat.cols(); ++j) {
-				if (src->floatMat(i, j) < -900) continue;
-				accs[j]((double)src->floatMat(i, j));
+
+		// Each column is read separately. With the column store, the values
+		// are contiguous. Otherwise, walk down floatMat with a stride of one row.
+		std::shared_ptr<const db::data_columns> cols;
+		if (db::useColumnStore()) cols = src->getColumns();
+		// If a row list is given, only those rows are used.
+		const size_t numRows = (rows) ? rows->size() : (size_t)src->floatMat.rows();
+		res->count = (uint64_t)numRows;
+
+		// Only the requested columns are read, and the median selection and
+		// moment sums are skipped when nothing needs them.
+		res->floatStats.setConstant(std::numeric_limits<float>::quiet_NaN());
+		std::vector<size_t> wanted;
+		for (int j = 0; j < data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j)
+			if (req.wantColumn(j)) wanted.push_back((size_t)j);
+		const bool needMedian = req.wantStat(data_entries::SDBR_MEDIAN);
+		const bool needSums = req.wantStat(data_entries::SDBR_S_MIN) || req.wantStat(data_entries::SDBR_S_MAX)
+			|| req.wantStat(data_entries::SDBR_MEAN) || req.wantStat(data_entries::SDBR_SD)
+			|| req.wantStat(data_entries::SDBR_SKEWNESS) || req.wantStat(data_entries::SDBR_KURTOSIS);
+		if (!needMedian && !needSums) return res;
+
+		const size_t numWorkers = (numRows >= parallelRows)
+			? parallel::resolveThreads(0, wanted.size()) : 1;
+		parallel::runWorkers(numWorkers, [&](size_t t) {
+			std::vector<float> vals(numRows);
+			for (size_t w = t; w < wanted.size(); w += numWorkers) {
+				const int j = (int)wanted[w];
+				const size_t n = packColumn(src, cols.get(), rows, numRows, j, vals);
+				const central c = (needSums) ? centralMoments(vals.data(), n) : central();
+				const float med = (needMedian) ? median(vals, n) : 0;
+				setColumn(res->floatStats, j, c.mn, c.mx, c.mean, c.c2, c.c3, c.c4, med, req);
 			}
+		});
+		return res;
+	}
+
+	std::shared_ptr<const db::data_stats> db::getStats(const stats_request &req) const {
+		if (req == stats_request()) return getStats();
+		{
+			std::lock_guard<std::mutex> lock(m_stats);
+			auto it = pStatsRequests.find(req);
+			if (it != pStatsRequests.end()) return it->second;
 		}
-		res->count = (int)src->floatMat.rows();
+		auto res = data_stats::generate(this, req);
+		std::lock_guard<std::mutex> lock(m_stats);
+		pStatsRequests[req] = res;
+		return res;
+	}
 
-		// Extract the parameters
-#ifdef min
-#undef min
-#endif
-#ifdef max
-#undef max
-#endif
-		//typedef Eigen::Matrix<float, data_entries::SDBR_NUM_DATA_ENTRIES_STATS,
-		//	data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS> StatsFloatType;
-		for (int j = 0; j<data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j) {
-			res->floatStats(data_entries::SDBR_S_MIN, j) = (float)boost::accumulators::min(accs[j]);
-			res->floatStats(data_entries::SDBR_S_MAX, j) = (float)boost::accumulators::max(accs[j]);
-			res->floatStats(data_entries::SDBR_MEAN, j) = (float)boost::accumulators::mean(accs[j]);
-			res->floatStats(data_entries::SDBR_MEDIAN, j) = (float)boost::accumulators::median(accs[j]);
-			res->floatStats(data_entries::SDBR_SKEWNESS, j) = (float)boost::accumulators::skewness(accs[j]);
-			res->floatStats(data_entries::SDBR_KURTOSIS, j) = (float)boost::accumulators::kurtosis(accs[j]);
-			res->floatStats(data_entries::SDBR_SD, j) = (float)std::pow(boost::accumulators::variance(accs[j]), 0.5);
+	std::shared_ptr<const db::data_stats> db_view::getStats(const db::stats_request &req) const {
+		if (req == db::stats_request()) return getStats();
+		{
+			std::lock_guard<std::mutex> lock(m_stats);
+			auto it = pStatsRequests.find(req);
+			if (it != pStatsRequests.end()) return it->second;
 		}
+		auto res = queryCache::memoize<db::data_stats>([&]() {
+			return queryCache::keyBuilder(queryCache::kinds::STATS)
+				.add(parent->serial).add(*rowsHash()).add(req.columns).add(req.stats);
+		}, [&]() { return db::data_stats::generate(parent.get(), rows, req); });
+		std::lock_guard<std::mutex> lock(m_stats);
+		pStatsRequests[req] = res;
 		return res;
 	}
 
-}
+	const size_t db::data_stats_partial::sketchSize;
+
+	db::data_stats_partial::column_state::column_state() : n(0),
+		mn(std::numeric_limits<float>::infinity()), mx(-std::numeric_limits<float>::infinity()),
+		mean(0), m2(0), m3(0), m4(0) {}
+
+	db::data_stats_partial::data_stats_partial() : count(0) {}
+	db::data_stats_partial::~data_stats_partial() {}
+
+	std::shared_ptr<db::data_stats_partial> db::data_stats_partial::generate() {
+		return std::shared_ptr<db::data_stats_partial>(new db::data_stats_partial);
+	}
+
+	std::shared_ptr<db::data_stats_partial> db::data_stats_partial::generate(const db* src) {
+		auto res = generate();
+		res->add(src);
+		return res;
+	}
+
+	std::shared_ptr<db::data_stats_partial> db::data_stats_partial::generate(
+		const db* src, const RowIdsType &rows) {
+		auto res = generate();
+		res->add(src, rows);
+		return res;
+	}
+
+	namespace {
+		typedef db::data_stats_partial::column_state column_state;
+
+		/// Combine the moments of b into a (Pebay, 2008)
+		void mergeMoments(column_state &a, uint64_t nb, double meanb,
+			double m2b, double m3b, double m4b, float mnb, float mxb) {
+			if (!nb) return;
+			a.mn = std::min(a.mn, mnb);
+			a.mx = std::max(a.mx, mxb);
+			if (!a.n) {
+				a.n = nb;
+				a.mean = meanb;
+				a.m2 = m2b;
+				a.m3 = m3b;
+				a.m4 = m4b;
+				return;
+			}
+			const double na = (double)a.n, dnb = (double)nb, n = na + dnb;
+			const double delta = meanb - a.mean;
+			const double dn = delta / n;
+			const double m2 = a.m2 + m2b + (delta * dn * na * dnb);
+			const double m3 = a.m3 + m3b + (delta * dn * dn * na * dnb * (na - dnb))
+				+ (3. * dn * ((na * m2b) - (dnb * a.m2)));
+			const double m4 = a.m4 + m4b
+				+ (delta * dn * dn * dn * na * dnb * ((na * na) - (na * dnb) + (dnb * dnb)))
+				+ (6. * dn * dn * ((na * na * m2b) + (dnb * dnb * a.m2)))
+				+ (4. * dn * ((na * m3b) - (dnb * a.m3)));
+			a.n += nb;
+			a.mean += dnb * dn;
+			a.m2 = m2;
+			a.m3 = m3;
+			a.m4 = m4;
+		}
+
+		/// Halve any sketch level that has grown past the sketch size. The
+		/// level is sorted, and every other value moves up a level with twice
+		/// the weight. Levels alternate between keeping the odd and the even
+		/// values. With an odd count, the largest value stays behind so that
+		/// the total weight is unchanged.
+		void compactSketch(column_state &c) {
+			const size_t k = db::data_stats_partial::sketchSize;
+			for (size_t h = 0; h < c.levels.size(); ++h) {
+				if (c.levels[h].size() <= k) continue;
+				if (h + 1 == c.levels.size()) {
+					c.levels.push_back(std::vector<float>());
+					c.parity.push_back(false);
+				}
+				std::vector<float> &lv = c.levels[h];
+				std::vector<float> &next = c.levels[h + 1];
+				std::sort(lv.begin(), lv.end());
+				const size_t even = lv.size() - (lv.size() % 2);
+				for (size_t i = (c.parity[h]) ? 1 : 0; i < even; i += 2) next.push_back(lv[i]);
+				c.parity[h] = !c.parity[h];
+				if (lv.size() % 2) lv.assign(1, lv.back());
+				else lv.clear();
+			}
+		}
+
+		float sketchMedian(const column_state &c) {
+			if (!c.n) return 0;
+			if (c.levels.size() <= 1) {
+				std::vector<float> vals(c.levels[0]);
+				return median(vals, vals.size());
+			}
+			std::vector<std::pair<float, uint64_t> > items;
+			for (size_t h = 0; h < c.levels.size(); ++h)
+				for (const auto &v : c.levels[h]) items.push_back(std::make_pair(v, 1ULL << h));
+			std::sort(items.begin(), items.end());
+			// Find the values holding the two middle ranks
+			const uint64_t lowRank = (c.n - 1) / 2, highRank = c.n / 2;
+			float low = items.back().first, high = items.back().first;
+			uint64_t seen = 0;
+			bool haveLow = false;
+			for (const auto &it : items) {
+				seen += it.second;
+				if (!haveLow && seen > lowRank) { low = it.first; haveLow = true; }
+				if (seen > highRank) { high = it.first; break; }
+			}
+			return (float)(((double)low + (double)high) / 2.);
+		}
+	}
+
+	void db::data_stats_partial::add(const db* src) { add(src, (const RowIdsType*) nullptr); }
+	void db::data_stats_partial::add(const db* src, const RowIdsType &rows) { add(src, &rows); }
+
+	void db::data_stats_partial::add(const db* src, const RowIdsType *rows) {
+		if (!src) return;
+		std::shared_ptr<const db::data_columns> dcols;
+		if (db::useColumnStore()) dcols = src->getColumns();
+		const size_t numRows = (rows) ? rows->size() : (size_t)src->floatMat.rows();
+		count += (uint64_t)numRows;
+		std::vector<float> vals(numRows);
+		for (int j = 0; j < data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j) {
+			const size_t n = packColumn(src, dcols.get(), rows, numRows, j, vals);
+			if (!n) continue;
+			const central c = centralMoments(vals.data(), n);
+			const double dn = (double)n;
+			mergeMoments(cols[j], (uint64_t)n, c.mean, c.c2 * dn, c.c3 * dn, c.c4 * dn, c.mn, c.mx);
+			if (!cols[j].levels.size()) {
+				cols[j].levels.resize(1);
+				cols[j].parity.resize(1, false);
+			}
+			cols[j].levels[0].insert(cols[j].levels[0].end(), vals.begin(), vals.begin() + n);
+			compactSketch(cols[j]);
+		}
+	}
+
+	void db::data_stats_partial::merge(const data_stats_partial &other) {
+		count += other.count;
+		for (int j = 0; j < data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j) {
+			const column_state &b = other.cols[j];
+			column_state &a = cols[j];
+			mergeMoments(a, b.n, b.mean, b.m2, b.m3, b.m4, b.mn, b.mx);
+			if (a.levels.size() < b.levels.size()) {
+				a.levels.resize(b.levels.size());
+				a.parity.resize(b.levels.size(), false);
+			}
+			for (size_t h = 0; h < b.levels.size(); ++h)
+				a.levels[h].insert(a.levels[h].end(), b.levels[h].begin(), b.levels[h].end());
+			compactSketch(a);
+		}
+	}
 
+	std::shared_ptr<const db::data_stats> db::data_stats_partial::finalize() const {
+		std::shared_ptr<db::data_stats> res(new db::data_stats);
+		res->count = count;
+		for (int j = 0; j < data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS; ++j) {
+			const column_state &c = cols[j];
+			const double dn = (double)c.n;
+			const double mean = (c.n) ? c.mean : std::numeric_limits<double>::quiet_NaN();
+			const double c2 = (c.n) ? std::max(0., c.m2 / dn) : 0.;
+			setColumn(res->floatStats, j, c.mn, c.mx, mean, c2, c.m3 / dn, c.m4 / dn,
+				sketchMedian(c));
+		}
+		return res;
+	}
+}
@@ -0,0 +1,96 @@
+#include "../scatdb/defs.hpp"
+#include <memory>
+#include <mutex>
+#include "../scatdb/error.hpp"
+#include "../scatdb/hash.hpp"
+#include "../scatdb/scatdb.hpp"
+#include "../private/queryCache.hpp"
+
+namespace {
+	std::mutex m_view;
+	/// Guards pStats. It is held only to check or publish the statistics.
+	std::mutex m_viewStats;
+}
+
+namespace scatdb {
+	std::shared_ptr<db> db::gatherRows(const db* src, const RowIdsType& rows) {
+		std::shared_ptr<db> res(new db);
+		const Eigen::Index numRows = (Eigen::Index)rows.size();
+		res->floatMat.resize(numRows, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS);
+		res->intMat.resize(numRows, data_entries::SDBR_NUM_DATA_ENTRIES_INTS);
+		const bool hasPhase = src->phaseMat.rows() != 0;
+		if (hasPhase) res->phaseMat.resize(numRows, src->phaseMat.cols());
+		for (Eigen::Index i = 0; i < numRows; ++i) {
+			const Eigen::Index r = (Eigen::Index)rows[(size_t)i];
+			res->floatMat.block<1, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS>(i, 0)
+				= src->floatMat.block<1, data_entries::SDBR_NUM_DATA_ENTRIES_FLOATS>(r, 0);
+			res->intMat.block<1, data_entries::SDBR_NUM_DATA_ENTRIES_INTS>(i, 0)
+				= src->intMat.block<1, data_entries::SDBR_NUM_DATA_ENTRIES_INTS>(r, 0);
+			if (hasPhase) res->phaseMat.row(i) = src->phaseMat.row(r);
+		}
+		return res;
+	}
+
+	db_view::db_view() {}
+	db_view::~db_view() {}
+
+	std::shared_ptr<const db_view> db_view::generate(std::shared_ptr<const db> src) {
+		if (!src) SDBR_throw(scatdb::error::error_types::xNullPointer)
+			.add<std::string>("Reason", "The source database is NULL.");
+		std::shared_ptr<db_view> res(new db_view);
+		res->parent = src;
+		res->rows.resize((size_t)src->floatMat.rows());
+		for (size_t i = 0; i < res->rows.size(); ++i) res->rows[i] = (uint64_t)i;
+		return res;
+	}
+
+	std::shared_ptr<const db_view> db_view::generate(
+		std::shared_ptr<const db> src, const db::RowIdsType& rows) {
+		if (!src) SDBR_throw(scatdb::error::error_types::xNullPointer)
+			.add<std::string>("Reason", "The source database is NULL.");
+		const uint64_t srcRows = (uint64_t)src->floatMat.rows();
+		for (const auto &r : rows)
+			if (r >= srcRows) SDBR_throw(scatdb::error::error_types::xArrayOutOfBounds)
+				.add<uint64_t>("row", r)
+				.add<uint64_t>("numRows", srcRows);
+		std::shared_ptr<db_view> res(new db_view);
+		res->parent = src;
+		res->rows = rows;
+		return res;
+	}
+
+	std::shared_ptr<const db> db_view::getParent() const { return parent; }
+	const db::RowIdsType& db_view::getRows() const { return rows; }
+	uint64_t db_view::numRows() const { return (uint64_t)rows.size(); }
+
+	std::shared_ptr<const db> db_view::materialize() const {
+		std::lock_guard<std::mutex> lock(m_view);
+		if (!pMaterialized)
+			pMaterialized = db::gatherRows(parent.get(), rows);
+		return pMaterialized;
+	}
+
+	hash::HASH_p db_view::rowsHash() const {
+		std::lock_guard<std::mutex> lock(m_view);
+		if (!pRowsHash)
+			pRowsHash = hash::HASH(rows.data(), (int)(rows.size() * sizeof(uint64_t)));
+		return pRowsHash;
+	}
+
+	std::shared_ptr<const db::data_stats> db_view::getStats() const {
+		{
+			std::lock_guard<std::mutex> lock(m_viewStats);
+			if (this->pStats) return this->pStats;
+		}
+		// Computed outside of the lock; if two threads race, the first
+		// result is kept.
+		auto res = queryCache::memoize<db::data_stats>([&]() {
+			const db::stats_request all;
+			return queryCache::keyBuilder(queryCache::kinds::STATS)
+				.add(parent->serial).add(*rowsHash()).add(all.columns).add(all.stats);
+		}, [&]() { return db::data_stats::generate(parent.get(), rows); });
+		std::lock_guard<std::mutex> lock(m_viewStats);
+		if (!this->pStats) this->pStats = res;
+		return this->pStats;
+	}
+}
@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 #include <boost/iostreams/copy.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/spirit/include/karma.hpp>
 #include <boost/spirit/include/qi.hpp>